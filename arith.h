@@ -0,0 +1,828 @@
+/* arithmetic expansion: $(( EXPRESSION ))
+ *
+ * expressions use 64 bit integers and the C operators (plus '**'); they are
+ * parsed once into a flat tree, with constant subexpressions folded while
+ * parsing, and the parsed form is cached by its text for later evaluations;
+ * '$NAME' and '${NAME}' references are parsed as well, so that an expression
+ * such as '$i + 1' in a loop isn't parsed again for every value of 'i' */
+class Arithmetic
+{
+public:
+        /* prints a diagnostic and returns nothing on errors */
+        static std::optional<std::int64_t> evaluate(const std::string_view text)
+        {
+                return evaluate(text, 0);
+        }
+
+        /* evaluates an expression with '$NAME' and '${NAME}' references as if
+         * each had been replaced by the value of the variable; returns false,
+         * evaluating nothing, when the text has to be expanded first: for other
+         * expansions or for values that aren't plain numbers */
+        static bool evaluate_refs(const std::string_view text, std::optional<std::int64_t>& result)
+        {
+                auto it = ref_cache.find(text);
+                if(it == ref_cache.end())
+                {
+                        std::optional<Expr> expr(std::in_place);
+                        if(!Parser(text, *expr, true).parse())
+                        {
+                                expr.reset();
+                        }
+
+                        if(ref_cache.size() >= CACHE_LIMIT)
+                        {
+                                ref_cache.clear();
+                        }
+
+                        it = ref_cache.emplace(std::string(text), std::move(expr)).first;
+                }
+
+                if(!it->second.has_value())
+                {
+                        return false;
+                }
+
+                /* all references are read before anything is evaluated, as the
+                 * substitution would have happened before */
+                const Expr& expr = *it->second;
+                ref_values.clear();
+                for(const auto& name : expr.ref_names)
+                {
+                        const auto* var = shell_vars.find(name);
+                        if(var == nullptr || var->array != nullptr)
+                        {
+                                return false;
+                        }
+
+                        const auto value = parse_number(var->value);
+                        if(!value.has_value())
+                        {
+                                return false;
+                        }
+
+                        ref_values.push_back(*value);
+                }
+
+                result = eval(expr, expr.root, 0);
+                return true;
+        }
+
+private:
+        static constexpr std::size_t CACHE_LIMIT = 512;
+        static constexpr int RECURSION_LIMIT = 16;
+
+        enum class Op : std::uint8_t
+        {
+                NUM,
+                VAR,
+                REF,
+                NEG,
+                NOT,
+                BITNOT,
+                PRE_INC,
+                PRE_DEC,
+                POST_INC,
+                POST_DEC,
+                POW,
+                MUL,
+                DIV,
+                MOD,
+                ADD,
+                SUB,
+                SHL,
+                SHR,
+                LT,
+                LE,
+                GT,
+                GE,
+                EQ,
+                NE,
+                BITAND,
+                BITXOR,
+                BITOR,
+                AND,
+                OR,
+                COND,
+                ASSIGN,
+                COMMA
+        };
+
+        struct Node
+        {
+                Op op;
+                Op assign_op; /* for ASSIGN: the operator of a compound assignment, or NUM */
+                std::uint32_t a = 0;
+                std::uint32_t b = 0;
+                std::uint32_t c = 0;
+                std::int64_t value = 0; /* NUM: the value, VAR: index in 'names', REF: in 'ref_names' */
+        };
+
+        struct Expr
+        {
+                std::vector<Node> nodes;
+                std::vector<std::string> names;
+                std::vector<std::string> ref_names;
+                std::uint32_t root = 0;
+        };
+
+        struct BinaryOp
+        {
+                std::string_view symbol;
+                Op op;
+                int prec;
+        };
+
+        /* longer symbols first, so that e.g. '<<' isn't taken for '<' */
+        static constexpr std::array<BinaryOp, 18> binary_ops = {{
+            {"**", Op::POW, 12},
+            {"<<", Op::SHL, 9},
+            {">>", Op::SHR, 9},
+            {"<=", Op::LE, 8},
+            {">=", Op::GE, 8},
+            {"==", Op::EQ, 7},
+            {"!=", Op::NE, 7},
+            {"&&", Op::AND, 3},
+            {"||", Op::OR, 2},
+            {"*", Op::MUL, 11},
+            {"/", Op::DIV, 11},
+            {"%", Op::MOD, 11},
+            {"+", Op::ADD, 10},
+            {"-", Op::SUB, 10},
+            {"<", Op::LT, 8},
+            {">", Op::GT, 8},
+            {"&", Op::BITAND, 6},
+            {"^", Op::BITXOR, 5},
+        }};
+
+        static constexpr std::array<BinaryOp, 11> assign_ops = {{
+            {"<<=", Op::SHL, 0},
+            {">>=", Op::SHR, 0},
+            {"*=", Op::MUL, 0},
+            {"/=", Op::DIV, 0},
+            {"%=", Op::MOD, 0},
+            {"+=", Op::ADD, 0},
+            {"-=", Op::SUB, 0},
+            {"&=", Op::BITAND, 0},
+            {"^=", Op::BITXOR, 0},
+            {"|=", Op::BITOR, 0},
+            {"=", Op::NUM, 0},
+        }};
+
+        class Parser
+        {
+        public:
+                Parser(const std::string_view text, Expr& expr, const bool allow_refs = false)
+                    : text(text)
+                    , expr(expr)
+                    , allow_refs(allow_refs)
+                {
+                }
+
+                bool parse()
+                {
+                        expr.root = parse_comma();
+                        skip_spaces();
+
+                        return !failed && pos == text.size();
+                }
+
+        private:
+                void skip_spaces()
+                {
+                        while(pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                        {
+                                ++pos;
+                        }
+                }
+
+                bool accept(const std::string_view symbol)
+                {
+                        skip_spaces();
+                        if(text.compare(pos, symbol.size(), symbol) != 0)
+                        {
+                                return false;
+                        }
+
+                        pos += symbol.size();
+                        return true;
+                }
+
+                /* accepts 'symbol' unless it starts a longer operator, e.g. '|' in '||' */
+                bool accept_exact(const std::string_view symbol, const std::string_view longer)
+                {
+                        skip_spaces();
+                        if(text.compare(pos, longer.size(), longer) == 0)
+                        {
+                                return false;
+                        }
+
+                        return accept(symbol);
+                }
+
+                std::uint32_t add(const Node node)
+                {
+                        expr.nodes.push_back(node);
+                        return static_cast<std::uint32_t>(expr.nodes.size() - 1);
+                }
+
+                std::uint32_t fail()
+                {
+                        failed = true;
+                        return add({Op::NUM, Op::NUM});
+                }
+
+                bool is_const(const std::uint32_t idx) const
+                {
+                        return expr.nodes[idx].op == Op::NUM;
+                }
+
+                /* folds nodes whose operands are all constant */
+                std::uint32_t make(const Op op, const std::uint32_t a, const std::uint32_t b = 0,
+                                   const std::uint32_t c = 0)
+                {
+                        const Node node{op, Op::NUM, a, b, c};
+
+                        const bool unary = (op == Op::NEG || op == Op::NOT || op == Op::BITNOT);
+                        const bool foldable =
+                            is_const(a) && (unary || is_const(b)) && (op != Op::COND || is_const(c));
+                        if(!foldable || op == Op::ASSIGN || op == Op::COMMA)
+                        {
+                                return add(node);
+                        }
+
+                        const auto value = apply(node, expr.nodes[a].value, expr.nodes[b].value,
+                                                 expr.nodes[c].value);
+                        if(!value.has_value())
+                        {
+                                /* e.g. a constant division by zero; report it at evaluation */
+                                return add(node);
+                        }
+
+                        return add({Op::NUM, Op::NUM, 0, 0, 0, *value});
+                }
+
+                std::uint32_t parse_comma()
+                {
+                        std::uint32_t lhs = parse_assign();
+                        while(!failed && accept(","))
+                        {
+                                lhs = make(Op::COMMA, lhs, parse_assign());
+                        }
+
+                        return lhs;
+                }
+
+                std::uint32_t parse_assign()
+                {
+                        const std::uint32_t lhs = parse_cond();
+                        if(failed || expr.nodes[lhs].op != Op::VAR)
+                        {
+                                return lhs;
+                        }
+
+                        skip_spaces();
+                        for(const auto& assign_op : assign_ops)
+                        {
+                                /* '=' mustn't be taken from '==' */
+                                if(assign_op.symbol == "=" && text.compare(pos, 2, "==") == 0)
+                                {
+                                        break;
+                                }
+
+                                if(accept(assign_op.symbol))
+                                {
+                                        const std::uint32_t rhs = parse_assign();
+                                        const std::uint32_t idx = add({Op::ASSIGN, assign_op.op, lhs, rhs});
+                                        return idx;
+                                }
+                        }
+
+                        return lhs;
+                }
+
+                std::uint32_t parse_cond()
+                {
+                        const std::uint32_t cond = parse_binary(0);
+                        if(failed || !accept("?"))
+                        {
+                                return cond;
+                        }
+
+                        const std::uint32_t if_true = parse_comma();
+                        if(!accept(":"))
+                        {
+                                return fail();
+                        }
+
+                        const std::uint32_t if_false = parse_cond();
+                        return make(Op::COND, cond, if_true, if_false);
+                }
+
+                std::uint32_t parse_binary(const int min_prec)
+                {
+                        std::uint32_t lhs = parse_unary();
+                        while(!failed)
+                        {
+                                skip_spaces();
+
+                                /* '|' has a single character symbol that prefixes '||' and
+                                 * '|=', so it's handled apart from the table */
+                                const BinaryOp* found = nullptr;
+                                static constexpr BinaryOp bitor_op = {"|", Op::BITOR, 4};
+                                for(const auto& op : binary_ops)
+                                {
+                                        if(text.compare(pos, op.symbol.size(), op.symbol) == 0)
+                                        {
+                                                found = &op;
+                                                break;
+                                        }
+                                }
+
+                                if(found == nullptr && text.compare(pos, 1, "|") == 0 &&
+                                   text.compare(pos, 2, "|=") != 0)
+                                {
+                                        found = &bitor_op;
+                                }
+
+                                /* compound assignments end the operand */
+                                const bool compound_assign =
+                                    found != nullptr &&
+                                    text.compare(pos + found->symbol.size(), 1, "=") == 0 &&
+                                    found->op != Op::LE && found->op != Op::GE &&
+                                    found->op != Op::EQ && found->op != Op::NE;
+                                if(found == nullptr || found->prec < min_prec || compound_assign)
+                                {
+                                        break;
+                                }
+
+                                pos += found->symbol.size();
+
+                                /* '**' is right associative */
+                                const int next_prec = (found->op == Op::POW) ? found->prec : found->prec + 1;
+                                const std::uint32_t rhs = parse_binary(next_prec);
+                                lhs = make(found->op, lhs, rhs);
+                        }
+
+                        return lhs;
+                }
+
+                std::uint32_t parse_unary()
+                {
+                        if(accept("++") || accept("--"))
+                        {
+                                const Op op = (text[pos - 1] == '+') ? Op::PRE_INC : Op::PRE_DEC;
+                                const std::uint32_t operand = parse_unary();
+                                if(expr.nodes[operand].op != Op::VAR)
+                                {
+                                        return fail();
+                                }
+
+                                return add({op, Op::NUM, operand});
+                        }
+
+                        if(accept_exact("-", "-="))
+                        {
+                                return make(Op::NEG, parse_unary());
+                        }
+
+                        if(accept_exact("+", "+="))
+                        {
+                                return parse_unary();
+                        }
+
+                        if(accept_exact("!", "!="))
+                        {
+                                return make(Op::NOT, parse_unary());
+                        }
+
+                        if(accept("~"))
+                        {
+                                return make(Op::BITNOT, parse_unary());
+                        }
+
+                        return parse_postfix();
+                }
+
+                std::uint32_t parse_postfix()
+                {
+                        const std::uint32_t operand = parse_primary();
+                        if(failed || expr.nodes[operand].op != Op::VAR)
+                        {
+                                return operand;
+                        }
+
+                        if(accept("++"))
+                        {
+                                return add({Op::POST_INC, Op::NUM, operand});
+                        }
+
+                        if(accept("--"))
+                        {
+                                return add({Op::POST_DEC, Op::NUM, operand});
+                        }
+
+                        return operand;
+                }
+
+                std::uint32_t parse_primary()
+                {
+                        if(accept("("))
+                        {
+                                const std::uint32_t inner = parse_comma();
+                                if(!accept(")"))
+                                {
+                                        return fail();
+                                }
+
+                                return inner;
+                        }
+
+                        if(allow_refs && accept("$"))
+                        {
+                                return parse_ref();
+                        }
+
+                        skip_spaces();
+                        const std::size_t start = pos;
+                        while(pos < text.size() &&
+                              (std::isalnum(static_cast<unsigned char>(text[pos])) ||
+                               text[pos] == '_' || text[pos] == '#'))
+                        {
+                                ++pos;
+                        }
+
+                        const std::string_view token = text.substr(start, pos - start);
+                        if(token.empty())
+                        {
+                                return fail();
+                        }
+
+                        if(is_valid_name(token))
+                        {
+                                expr.names.emplace_back(token);
+                                return add({Op::VAR, Op::NUM, 0, 0, 0,
+                                            static_cast<std::int64_t>(expr.names.size() - 1)});
+                        }
+
+                        const auto value = parse_number(token);
+                        if(!value.has_value())
+                        {
+                                return fail();
+                        }
+
+                        return add({Op::NUM, Op::NUM, 0, 0, 0, *value});
+                }
+
+                /* 'NAME' or '{NAME}' after a '$'; anything else isn't parsed here */
+                std::uint32_t parse_ref()
+                {
+                        const bool braced = (text.compare(pos, 1, "{") == 0);
+                        const std::size_t start = pos + (braced ? 1 : 0);
+
+                        std::size_t end = start;
+                        while(end < text.size() &&
+                              (std::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_'))
+                        {
+                                ++end;
+                        }
+
+                        const std::string_view name = text.substr(start, end - start);
+                        if(!is_valid_name(name) || (braced && text.compare(end, 1, "}") != 0))
+                        {
+                                return fail();
+                        }
+
+                        pos = end + (braced ? 1 : 0);
+
+                        expr.ref_names.emplace_back(name);
+                        return add({Op::REF, Op::NUM, 0, 0, 0,
+                                    static_cast<std::int64_t>(expr.ref_names.size() - 1)});
+                }
+
+                std::string_view text;
+                Expr& expr;
+                const bool allow_refs;
+                std::size_t pos = 0;
+                bool failed = false;
+        };
+
+        /* decimal, 0x hexadecimal, 0 octal or BASE#DIGITS */
+        static std::optional<std::int64_t> parse_number(std::string_view sv)
+        {
+                int base = 10;
+
+                const auto hash_pos = sv.find('#');
+                if(hash_pos != sv.npos)
+                {
+                        const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + hash_pos, base);
+                        if(ec != std::errc() || ptr != sv.data() + hash_pos || base < 2 || base > 36)
+                        {
+                                return std::nullopt;
+                        }
+
+                        sv.remove_prefix(hash_pos + 1);
+                }
+                else if(sv.size() > 2 && sv[0] == '0' && (sv[1] == 'x' || sv[1] == 'X'))
+                {
+                        base = 16;
+                        sv.remove_prefix(2);
+                }
+                else if(sv.size() > 1 && sv[0] == '0')
+                {
+                        base = 8;
+                        sv.remove_prefix(1);
+                }
+
+                std::uint64_t value = 0;
+                const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value, base);
+                if(sv.empty() || ec != std::errc() || ptr != sv.data() + sv.size())
+                {
+                        return std::nullopt;
+                }
+
+                return static_cast<std::int64_t>(value);
+        }
+
+        /* the value of an operator node, given its operand values; nothing for
+         * operations without a result (division by zero, negative exponents) */
+        static std::optional<std::int64_t> apply(const Node& node, const std::int64_t a,
+                                                 const std::int64_t b, const std::int64_t c)
+        {
+                /* wrap around on overflow, like the usual shells do */
+                const auto ua = static_cast<std::uint64_t>(a);
+                const auto ub = static_cast<std::uint64_t>(b);
+
+                switch(node.op)
+                {
+                case Op::NEG:
+                        return static_cast<std::int64_t>(0 - ua);
+                case Op::NOT:
+                        return a == 0;
+                case Op::BITNOT:
+                        return ~a;
+                case Op::POW:
+                {
+                        if(b < 0)
+                        {
+                                return std::nullopt;
+                        }
+
+                        std::uint64_t res = 1;
+                        std::uint64_t base = ua;
+                        for(std::uint64_t exp = ub; exp != 0; exp >>= 1)
+                        {
+                                if(exp & 1)
+                                {
+                                        res *= base;
+                                }
+                                base *= base;
+                        }
+
+                        return static_cast<std::int64_t>(res);
+                }
+                case Op::MUL:
+                        return static_cast<std::int64_t>(ua * ub);
+                case Op::DIV:
+                case Op::MOD:
+                        if(b == 0)
+                        {
+                                return std::nullopt;
+                        }
+
+                        /* the one quotient that doesn't fit */
+                        if(a == std::numeric_limits<std::int64_t>::min() && b == -1)
+                        {
+                                return (node.op == Op::DIV) ? a : 0;
+                        }
+
+                        return (node.op == Op::DIV) ? a / b : a % b;
+                case Op::ADD:
+                        return static_cast<std::int64_t>(ua + ub);
+                case Op::SUB:
+                        return static_cast<std::int64_t>(ua - ub);
+                case Op::SHL:
+                        return static_cast<std::int64_t>(ua << (ub & 63));
+                case Op::SHR:
+                        return a >> (ub & 63);
+                case Op::LT:
+                        return a < b;
+                case Op::LE:
+                        return a <= b;
+                case Op::GT:
+                        return a > b;
+                case Op::GE:
+                        return a >= b;
+                case Op::EQ:
+                        return a == b;
+                case Op::NE:
+                        return a != b;
+                case Op::BITAND:
+                        return a & b;
+                case Op::BITXOR:
+                        return a ^ b;
+                case Op::BITOR:
+                        return a | b;
+                case Op::AND:
+                        return a != 0 && b != 0;
+                case Op::OR:
+                        return a != 0 || b != 0;
+                case Op::COND:
+                        return (a != 0) ? b : c;
+                default:
+                        return std::nullopt;
+                }
+        }
+
+        static std::optional<std::int64_t> evaluate(const std::string_view text, const int depth)
+        {
+                if(depth > RECURSION_LIMIT)
+                {
+                        print_err_fmt("shellter: arithmetic: expression recursion level exceeded\n");
+                        return std::nullopt;
+                }
+
+                auto it = cache.find(text);
+                if(it == cache.end())
+                {
+                        Expr expr;
+                        if(!Parser(text, expr).parse())
+                        {
+                                print_err_fmt("shellter: arithmetic: syntax error: '{}'\n", text);
+                                return std::nullopt;
+                        }
+
+                        /* only at the top level: the evaluations this one is nested in
+                         * still use their cached expressions */
+                        if(cache.size() >= CACHE_LIMIT && depth == 0)
+                        {
+                                cache.clear();
+                        }
+
+                        it = cache.emplace(std::string(text), std::move(expr)).first;
+                }
+
+                const Expr& expr = it->second;
+                return eval(expr, expr.root, depth);
+        }
+
+        /* variables hold numbers or expressions themselves; unset or empty is 0 */
+        static std::optional<std::int64_t> value_of(const std::string_view name, const int depth)
+        {
+                const auto* var = shell_vars.find(name);
+                if(var == nullptr || var->array != nullptr || var->value.empty())
+                {
+                        return 0;
+                }
+
+                const auto value = parse_number(var->value);
+                if(value.has_value())
+                {
+                        return value;
+                }
+
+                return evaluate(var->value, depth + 1);
+        }
+
+        static void assign(const std::string_view name, const std::int64_t value)
+        {
+                shell_vars.set(name, fmt::format_int(value).str());
+        }
+
+        static std::optional<std::int64_t> eval(const Expr& expr, const std::uint32_t idx,
+                                                const int depth)
+        {
+                const Node& node = expr.nodes[idx];
+                const auto name = [&](const std::uint32_t var_idx)
+                {
+                        return std::string_view(expr.names[expr.nodes[var_idx].value]);
+                };
+
+                switch(node.op)
+                {
+                case Op::NUM:
+                        return node.value;
+                case Op::VAR:
+                        return value_of(expr.names[node.value], depth);
+                case Op::REF:
+                        return ref_values[static_cast<std::size_t>(node.value)];
+                case Op::PRE_INC:
+                case Op::PRE_DEC:
+                case Op::POST_INC:
+                case Op::POST_DEC:
+                {
+                        const auto old_value = value_of(name(node.a), depth);
+                        if(!old_value.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        const bool inc = (node.op == Op::PRE_INC || node.op == Op::POST_INC);
+                        const auto new_value = static_cast<std::int64_t>(
+                            static_cast<std::uint64_t>(*old_value) + (inc ? 1 : -1));
+                        assign(name(node.a), new_value);
+
+                        const bool pre = (node.op == Op::PRE_INC || node.op == Op::PRE_DEC);
+                        return pre ? new_value : *old_value;
+                }
+                case Op::AND:
+                case Op::OR:
+                {
+                        /* short circuit */
+                        const auto lhs = eval(expr, node.a, depth);
+                        if(!lhs.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        if((node.op == Op::AND) == (*lhs == 0))
+                        {
+                                return node.op == Op::OR;
+                        }
+
+                        const auto rhs = eval(expr, node.b, depth);
+                        if(!rhs.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        return *rhs != 0;
+                }
+                case Op::COND:
+                {
+                        const auto cond = eval(expr, node.a, depth);
+                        if(!cond.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        return eval(expr, (*cond != 0) ? node.b : node.c, depth);
+                }
+                case Op::COMMA:
+                {
+                        if(!eval(expr, node.a, depth).has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        return eval(expr, node.b, depth);
+                }
+                case Op::ASSIGN:
+                {
+                        auto value = eval(expr, node.b, depth);
+                        if(!value.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        if(node.assign_op != Op::NUM)
+                        {
+                                const auto old_value = value_of(name(node.a), depth);
+                                if(!old_value.has_value())
+                                {
+                                        return std::nullopt;
+                                }
+
+                                value = apply({node.assign_op, Op::NUM}, *old_value, *value, 0);
+                                if(!value.has_value())
+                                {
+                                        print_err_fmt("shellter: arithmetic: invalid operand\n");
+                                        return std::nullopt;
+                                }
+                        }
+
+                        assign(name(node.a), *value);
+                        return value;
+                }
+                default:
+                        break;
+                }
+
+                /* unary and binary operators */
+                const bool unary = (node.op == Op::NEG || node.op == Op::NOT || node.op == Op::BITNOT);
+
+                const auto a = eval(expr, node.a, depth);
+                const auto b = unary ? std::optional<std::int64_t>(0) : eval(expr, node.b, depth);
+                if(!a.has_value() || !b.has_value())
+                {
+                        return std::nullopt;
+                }
+
+                const auto res = apply(node, *a, *b, 0);
+                if(!res.has_value())
+                {
+                        print_err_fmt("shellter: arithmetic: {}\n",
+                                      (node.op == Op::POW) ? "exponent less than 0"
+                                                           : "division by 0");
+                }
+
+                return res;
+        }
+
+        static string_map_t<Expr> cache;
+        static string_map_t<std::optional<Expr>> ref_cache; /* nothing for texts with other expansions */
+        static std::vector<std::int64_t> ref_values;
+};
+
+string_map_t<Arithmetic::Expr> Arithmetic::cache;
+string_map_t<std::optional<Arithmetic::Expr>> Arithmetic::ref_cache;
+std::vector<std::int64_t> Arithmetic::ref_values;
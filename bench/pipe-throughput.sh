@@ -0,0 +1,20 @@
+#!/bin/sh
+# Pushes GIB gibibytes through a two-stage shellter pipeline once per pipe
+# capacity and reports the throughput of each run.
+#
+# usage: bench/pipe-throughput.sh [GIB] [SIZE...]
+
+SHELLTER="${SHELLTER:-./shellter}"
+GIB="${1:-4}"
+[ $# -gt 0 ] && shift
+SIZES="${*:-64K 256K 1M}"
+
+for size in ${SIZES}; do
+        start=$(date +%s%N)
+        echo "pipesize ${size} dd if=/dev/zero bs=1M count=$((GIB * 1024)) status=none | dd of=/dev/null bs=1M status=none" \
+                | "${SHELLTER}"
+        end=$(date +%s%N)
+
+        awk -v size="${size}" -v gib="${GIB}" -v ns="$((end - start))" \
+                'BEGIN { printf "pipesize %-6s %6.2f GB/s\n", size, gib * 1.073741824 / (ns / 1e9) }'
+done
@@ -0,0 +1,348 @@
+/* brace expansion: 'a{b,c}d', '{1..10}', '{01..10..3}', '{a..e}'
+ *
+ * a word is parsed once into a tree of text, lists and ranges; the words it
+ * stands for are never built all at once, but computed one at a time from
+ * their index, like the digits of a mixed radix number, where the rightmost
+ * brace varies fastest */
+class BraceExpansion
+{
+public:
+        explicit BraceExpansion(const std::string_view word)
+        {
+                root = parse_sequence(word);
+        }
+
+        /* the number of words */
+        std::uint64_t size() const
+        {
+                return sequences[root].count;
+        }
+
+        /* stores word 'i' in 'out' */
+        void word_at(const std::uint64_t i, std::string& out) const
+        {
+                out.clear();
+                append_sequence(root, i, out);
+        }
+
+private:
+        struct Node
+        {
+                enum class Kind : std::uint8_t
+                {
+                        TEXT,
+                        LIST,
+                        RANGE
+                };
+
+                Kind kind;
+                std::string_view text = {};                  /* TEXT */
+                std::vector<std::size_t> alternatives = {};  /* LIST: sequences */
+                std::int64_t first = 0;                      /* RANGE */
+                std::int64_t step = 1;
+                int width = 0;                               /* zero padded numbers */
+                bool letters = false;
+                std::uint64_t count = 1;
+        };
+
+        struct Sequence
+        {
+                std::vector<std::size_t> parts;    /* nodes */
+                std::vector<std::uint64_t> strides; /* the product of the counts of the parts after each one */
+                std::uint64_t count = 1;
+        };
+
+        static std::uint64_t multiply(const std::uint64_t a, const std::uint64_t b)
+        {
+                std::uint64_t res;
+                return __builtin_mul_overflow(a, b, &res) ? std::numeric_limits<std::uint64_t>::max() : res;
+        }
+
+        /* position after the quoted text, escape or ${...} at 'pos' */
+        static std::size_t skip(const std::string_view word, const std::size_t pos)
+        {
+                if(word[pos] == '\\')
+                {
+                        return std::min(pos + 2, word.size());
+                }
+
+                if(word[pos] == '\'' || word[pos] == '"' || Lexer::is_expansion(word, pos))
+                {
+                        return std::min(Lexer::skip_quoted(word, pos), word.size());
+                }
+
+                return pos + 1;
+        }
+
+        /* position of the '}' matching the '{' at 'open', and the positions of
+         * the commas directly inside it */
+        static std::size_t find_close(const std::string_view word, const std::size_t open,
+                                      std::vector<std::size_t>& commas)
+        {
+                std::size_t depth = 0;
+                for(std::size_t pos = open + 1; pos < word.size();)
+                {
+                        const char c = word[pos];
+                        if(c == '{')
+                        {
+                                ++depth;
+                        }
+                        else if(c == '}' && depth-- == 0)
+                        {
+                                return pos;
+                        }
+                        else if(c == ',' && depth == 0)
+                        {
+                                commas.push_back(pos);
+                        }
+
+                        pos = skip(word, pos);
+                }
+
+                return word.npos;
+        }
+
+        std::size_t add_node(Node node)
+        {
+                nodes.push_back(std::move(node));
+                return nodes.size() - 1;
+        }
+
+        void add_text(Sequence& seq, const std::string_view text)
+        {
+                if(text.empty())
+                {
+                        return;
+                }
+
+                seq.parts.push_back(add_node({Node::Kind::TEXT, text}));
+        }
+
+        std::size_t parse_sequence(const std::string_view word)
+        {
+                Sequence seq;
+
+                std::size_t text_begin = 0;
+                for(std::size_t pos = 0; pos < word.size();)
+                {
+                        if(word[pos] != '{')
+                        {
+                                pos = skip(word, pos);
+                                continue;
+                        }
+
+                        std::vector<std::size_t> commas;
+                        const auto close = find_close(word, pos, commas);
+                        if(close == word.npos)
+                        {
+                                break;
+                        }
+
+                        const auto inner = word.substr(pos + 1, close - pos - 1);
+                        std::optional<Node> node;
+                        if(!commas.empty())
+                        {
+                                node = parse_list(word, pos, close, commas);
+                        }
+                        else
+                        {
+                                node = parse_range(inner);
+                        }
+
+                        /* '{a}' and '{}' stay as they are */
+                        if(!node.has_value())
+                        {
+                                ++pos;
+                                continue;
+                        }
+
+                        add_text(seq, word.substr(text_begin, pos - text_begin));
+                        seq.count = multiply(seq.count, node->count);
+                        seq.parts.push_back(add_node(std::move(*node)));
+
+                        pos = close + 1;
+                        text_begin = pos;
+                }
+
+                add_text(seq, word.substr(text_begin));
+
+                seq.strides.resize(seq.parts.size());
+                std::uint64_t stride = 1;
+                for(std::size_t p = seq.parts.size(); p-- > 0;)
+                {
+                        seq.strides[p] = stride;
+                        stride = multiply(stride, nodes[seq.parts[p]].count);
+                }
+
+                sequences.push_back(std::move(seq));
+                return sequences.size() - 1;
+        }
+
+        Node parse_list(const std::string_view word, const std::size_t open, const std::size_t close,
+                        const std::vector<std::size_t>& commas)
+        {
+                Node node{Node::Kind::LIST};
+                node.count = 0;
+
+                std::size_t begin = open + 1;
+                for(std::size_t i = 0; i <= commas.size(); ++i)
+                {
+                        const std::size_t end = (i < commas.size()) ? commas[i] : close;
+                        const auto seq = parse_sequence(word.substr(begin, end - begin));
+
+                        node.alternatives.push_back(seq);
+                        node.count += sequences[seq].count;
+                        begin = end + 1;
+                }
+
+                return node;
+        }
+
+        /* 'A..B' or 'A..B..STEP', with A and B both numbers or both letters */
+        static std::optional<Node> parse_range(const std::string_view inner)
+        {
+                const auto dots = inner.find("..");
+                if(dots == inner.npos)
+                {
+                        return std::nullopt;
+                }
+
+                const auto from = inner.substr(0, dots);
+                auto to = inner.substr(dots + 2);
+                std::uint64_t step = 1;
+
+                const auto step_dots = to.find("..");
+                if(step_dots != to.npos)
+                {
+                        const auto step_sv = to.substr(step_dots + 2);
+                        const auto parsed = to_number(step_sv);
+                        if(!parsed.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        /* the magnitude, taken unsigned so that the lowest value has one */
+                        const auto magnitude = static_cast<std::uint64_t>(*parsed);
+                        step = (*parsed == 0) ? 1 : (*parsed < 0 ? 0 - magnitude : magnitude);
+                        to = to.substr(0, step_dots);
+                }
+
+                Node node{Node::Kind::RANGE};
+
+                std::int64_t first;
+                std::int64_t last;
+                const auto from_num = to_number(from);
+                const auto to_num = to_number(to);
+                if(from_num.has_value() && to_num.has_value())
+                {
+                        first = *from_num;
+                        last = *to_num;
+
+                        /* '{01..10}' pads to the widest of the two */
+                        const auto padded = [](const std::string_view sv)
+                        {
+                                const auto digits = sv.substr(sv.starts_with('-') ? 1 : 0);
+                                return digits.size() > 1 && digits.front() == '0';
+                        };
+                        if(padded(from) || padded(to))
+                        {
+                                node.width = static_cast<int>(std::max(from.size(), to.size()));
+                        }
+                }
+                else if(from.size() == 1 && to.size() == 1 && std::isalpha(static_cast<unsigned char>(from[0])) &&
+                        std::isalpha(static_cast<unsigned char>(to[0])))
+                {
+                        first = from[0];
+                        last = to[0];
+                        node.letters = true;
+                }
+                else
+                {
+                        return std::nullopt;
+                }
+
+                /* the span of a range as wide as the whole int64_t range doesn't fit
+                 * in it; such a range has 2^64 words when the step is 1, which
+                 * doesn't fit in the count either, so it's no expansion */
+                const auto ufirst = static_cast<std::uint64_t>(first);
+                const auto ulast = static_cast<std::uint64_t>(last);
+                const std::uint64_t steps = ((last >= first) ? ulast - ufirst : ufirst - ulast) / step;
+                if(steps == std::numeric_limits<std::uint64_t>::max())
+                {
+                        return std::nullopt;
+                }
+
+                node.first = first;
+                node.step = static_cast<std::int64_t>((last >= first) ? step : 0 - step);
+                node.count = steps + 1;
+
+                return node;
+        }
+
+        static std::optional<std::int64_t> to_number(const std::string_view sv)
+        {
+                std::int64_t value = 0;
+                const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+                if(sv.empty() || ec != std::errc() || ptr != sv.data() + sv.size())
+                {
+                        return std::nullopt;
+                }
+
+                return value;
+        }
+
+        void append_sequence(const std::size_t seq_index, const std::uint64_t i, std::string& out) const
+        {
+                const Sequence& seq = sequences[seq_index];
+                for(std::size_t p = 0; p < seq.parts.size(); ++p)
+                {
+                        const Node& node = nodes[seq.parts[p]];
+                        append_node(node, (i / seq.strides[p]) % node.count, out);
+                }
+        }
+
+        void append_node(const Node& node, std::uint64_t i, std::string& out) const
+        {
+                switch(node.kind)
+                {
+                case Node::Kind::TEXT:
+                        out.append(node.text);
+                        break;
+                case Node::Kind::LIST:
+                        for(const auto alternative : node.alternatives)
+                        {
+                                const std::uint64_t count = sequences[alternative].count;
+                                if(i < count)
+                                {
+                                        append_sequence(alternative, i, out);
+                                        return;
+                                }
+                                i -= count;
+                        }
+                        break;
+                case Node::Kind::RANGE:
+                {
+                        /* wraps around in between, but the value itself is in range */
+                        const auto value = static_cast<std::int64_t>(static_cast<std::uint64_t>(node.first) +
+                                                                     i * static_cast<std::uint64_t>(node.step));
+                        if(node.letters)
+                        {
+                                out.push_back(static_cast<char>(value));
+                        }
+                        else if(node.width > 0)
+                        {
+                                fmt::format_to(std::back_inserter(out), "{:0{}}", value, node.width);
+                        }
+                        else
+                        {
+                                out.append(fmt::format_int(value).c_str());
+                        }
+                        break;
+                }
+                }
+        }
+
+        std::vector<Node> nodes;
+        std::vector<Sequence> sequences;
+        std::size_t root = 0;
+};
@@ -52,32 +52,45 @@ int cd(const args_t& args)
 
 int echo(const args_t& args)
 {
-        const std::size_t len = args.size();
-        for(std::size_t i = 1; i < len - 1; ++i)
-        {
-                fmt::print("{} ", args[i]);
-        }
+        FdWriter out(STDOUT_FILENO);
 
-        if(len > 1)
+        const std::size_t len = args.size();
+        for(std::size_t i = 1; i < len; ++i)
         {
-                fmt::print("{}\n", args.back());
+                out.append(args[i]);
+                out.append(i < len - 1 ? ' ' : '\n');
         }
 
-        return EXIT_SUCCESS;
+        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int exit(const args_t& args)
 {
         const std::size_t len = args.size();
 
-        if(len == 1)
+        /* a status that isn't a number ends the shell all the same, with 2 */
+        int status = EXIT_SUCCESS;
+        if(len == 2)
         {
-                ::exit(EXIT_SUCCESS);
+                const std::string_view arg = args[1];
+                const auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), status);
+                if(arg.empty() || ec != std::errc() || ptr != arg.data() + arg.size())
+                {
+                        print_err_fmt("shellter: exit: {}: numeric argument required\n", arg);
+                        status = 2;
+                }
         }
 
-        if(len == 2)
+        /* an embedded shell only ends the script it runs */
+        if(embedded && len <= 2)
+        {
+                running = false;
+                return (len == 1) ? last_status : status & 0xff;
+        }
+
+        if(len <= 2)
         {
-                ::exit(std::stoi(args[1]));
+                ::exit(status & 0xff);
         }
 
         print_err_fmt("shellter: exit: too many arguments\n");
@@ -93,8 +106,10 @@ int pwd(const args_t& args)
                 return EXIT_FAILURE;
         }
 
-        fmt::print("{}\n", fs::current_path().c_str());
-        return EXIT_SUCCESS;
+        FdWriter out(STDOUT_FILENO);
+        out.print("{}\n", fs::current_path().c_str());
+
+        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int history(const args_t& args)
@@ -106,24 +121,26 @@ int history(const args_t& args)
                 return EXIT_FAILURE;
         }
 
+        FdWriter out(STDOUT_FILENO);
         for(std::size_t i = 0; i < line_history.size(); ++i)
         {
-                fmt::print(" {}  {}\n", i + 1, line_history[i]);
+                out.print(" {}  {}\n", i + 1, line_history[i]);
         }
 
-        return EXIT_SUCCESS;
+        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int addenv(const args_t& args)
 {
         const std::size_t len = args.size();
-        if(len != 3 || args[1].front() != '$')
+        if(len != 3 || args[1].front() != '$' || !is_valid_name(args[1].substr(1)))
         {
                 print_err_fmt("shellter: addenv usage: addenv $VARNAME VALUE\n");
                 return EXIT_FAILURE;
         }
 
-        environment_vars[args[1]] = args[2];
+        const auto name = args[1].substr(1);
+        shell_vars.set(name, args[2]);
 
         return EXIT_SUCCESS;
 }
@@ -131,22 +148,338 @@ int addenv(const args_t& args)
 int eaddenv(const args_t& args)
 {
         const std::size_t len = args.size();
-        if(len != 3 || args[1].front() != '$')
+        if(len != 3 || args[1].front() != '$' || !is_valid_name(args[1].substr(1)))
         {
                 print_err_fmt("shellter: eaddenv usage: eaddenv $VARNAME VALUE\n");
                 return EXIT_FAILURE;
         }
 
-        if(setenv(args[1].data() + 1, args[2].data(), 1) < 0)
+        const auto name = args[1].substr(1);
+        shell_vars.set(name, args[2]);
+        shell_vars.set_exported(name, true);
+
+        return EXIT_SUCCESS;
+}
+
+int read(const args_t& args)
+{
+        using LineStatus = InputBuffers::LineStatus;
+
+        const std::size_t len = args.size();
+
+        bool raw = false;
+        std::size_t first_name = 1;
+        if(len > 1 && args[1] == "-r")
+        {
+                raw = true;
+                first_name = 2;
+        }
+
+        std::vector<std::string_view> names(args.begin() + first_name, args.end());
+        if(names.empty())
+        {
+                names.push_back("REPLY");
+        }
+
+        for(const auto name : names)
+        {
+                if(!is_valid_name(name))
+                {
+                        print_err_fmt("shellter: read usage: read [-r] [VARNAME]...\n");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        std::string line;
+        LineStatus status = InputBuffers::read_line(STDIN_FILENO, line);
+
+        /* without -r, a backslash at the end of the line continues it */
+        std::string next;
+        while(!raw && status == LineStatus::COMPLETE)
+        {
+                const auto last = line.find_last_not_of('\\');
+                const auto backslashes = line.size() - (last == line.npos ? 0 : last + 1);
+                if(backslashes % 2 == 0)
+                {
+                        break;
+                }
+
+                line.pop_back();
+                status = InputBuffers::read_line(STDIN_FILENO, next);
+                line += next;
+        }
+
+        if(status == LineStatus::ERROR)
+        {
+                print_err_fmt("shellter: read: {}\n", strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        /* split into fields; the last name gets the rest of the line and, without
+         * -r, backslashes escape the next character and are removed */
+        const auto is_ifs = [](const char c)
+        {
+                return c == ' ' || c == '\t' || c == '\n';
+        };
+
+        std::size_t pos = 0;
+        for(std::size_t i = 0; i < names.size(); ++i)
+        {
+                while(pos < line.size() && is_ifs(line[pos]))
+                {
+                        ++pos;
+                }
+
+                const bool last = (i == names.size() - 1);
+
+                std::string value;
+                std::size_t value_len = 0; /* without trailing separators */
+                while(pos < line.size())
+                {
+                        const char c = line[pos];
+                        if(!raw && c == '\\' && pos + 1 < line.size())
+                        {
+                                value += line[pos + 1];
+                                value_len = value.size();
+                                pos += 2;
+                                continue;
+                        }
+
+                        if(is_ifs(c) && !last)
+                        {
+                                break;
+                        }
+
+                        value += c;
+                        if(!is_ifs(c))
+                        {
+                                value_len = value.size();
+                        }
+                        ++pos;
+                }
+
+                value.resize(value_len);
+
+                shell_vars.set(names[i], std::move(value));
+        }
+
+        return (status == LineStatus::COMPLETE) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int mapfile(const args_t& args)
+{
+        static constexpr std::size_t READ_CHUNK = 256 * 1024;
+
+        const std::size_t len = args.size();
+
+        bool strip = false;
+        std::size_t name_pos = 1;
+        if(len > 1 && args[1] == "-t")
+        {
+                strip = true;
+                name_pos = 2;
+        }
+
+        const std::string_view name = (len > name_pos) ? std::string_view(args[name_pos]) : "MAPFILE";
+        if(len > name_pos + 1 || !is_valid_name(name))
+        {
+                print_err_fmt("shellter: mapfile usage: mapfile [-t] [ARRAY]\n");
+                return EXIT_FAILURE;
+        }
+
+        std::string data;
+
+        /* regular files are mapped in one go, everything else is read in large chunks */
+        void* mapping = MAP_FAILED;
+        std::size_t mapping_len = 0;
+        std::string_view input = data;
+
+        struct stat st;
+        const off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        if(fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset)
+        {
+                /* the mapping has to start on a page boundary */
+                const off_t page_offset = offset & ~static_cast<off_t>(sysconf(_SC_PAGESIZE) - 1);
+                mapping_len = static_cast<std::size_t>(st.st_size - page_offset);
+                mapping = mmap(nullptr, mapping_len, PROT_READ, MAP_PRIVATE, STDIN_FILENO, page_offset);
+
+                if(mapping != MAP_FAILED)
+                {
+                        madvise(mapping, mapping_len, MADV_SEQUENTIAL);
+                        input = std::string_view(static_cast<const char*>(mapping), mapping_len)
+                                    .substr(static_cast<std::size_t>(offset - page_offset));
+                        lseek(STDIN_FILENO, st.st_size, SEEK_SET);
+                }
+        }
+
+        if(mapping == MAP_FAILED)
+        {
+                while(true)
+                {
+                        const std::size_t old_size = data.size();
+                        data.resize(old_size + READ_CHUNK);
+
+                        const ssize_t n = ::read(STDIN_FILENO, data.data() + old_size, READ_CHUNK);
+                        data.resize(old_size + static_cast<std::size_t>(std::max<ssize_t>(n, 0)));
+
+                        if(n < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+
+                        if(n < 0)
+                        {
+                                print_err_fmt("shellter: mapfile: {}\n", strerror(errno));
+                                return EXIT_FAILURE;
+                        }
+
+                        if(n == 0)
+                        {
+                                break;
+                        }
+                }
+
+                input = data;
+        }
+
+        /* split on newlines; memchr() does the scanning with vector instructions */
+        ShellArray arr;
+        arr.arena.reserve(input.size());
+
+        const char* pos = input.data();
+        const char* const end = input.data() + input.size();
+        while(pos < end)
+        {
+                const auto* nl = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+                const char* line_end = (nl != nullptr) ? nl + 1 : end;
+
+                arr.push_back(std::string_view(pos, (strip && nl != nullptr) ? nl : line_end));
+                pos = line_end;
+        }
+
+        if(mapping != MAP_FAILED)
+        {
+                munmap(mapping, mapping_len);
+        }
+
+        shell_vars.set_array(name, std::move(arr));
+
+        return EXIT_SUCCESS;
+}
+
+int export_(const args_t& args)
+{
+        const std::size_t len = args.size();
+
+        bool unexport = false;
+        std::size_t first_name = 1;
+        if(len > 1 && args[1] == "-n")
+        {
+                unexport = true;
+                first_name = 2;
+        }
+
+        if(len == first_name)
         {
+                print_err_fmt("shellter: export usage: export [-n] VARNAME[=VALUE]...\n");
                 return EXIT_FAILURE;
         }
 
-        environment_vars[args[1]] = args[2];
+        int ret = EXIT_SUCCESS;
+        for(std::size_t i = first_name; i < len; ++i)
+        {
+                const std::string_view arg = args[i];
+                const auto eq_pos = arg.find('=');
+                const auto name = arg.substr(0, eq_pos);
+
+                if(!is_valid_name(name))
+                {
+                        print_err_fmt("shellter: export: not a valid name: '{}'\n", name);
+                        ret = EXIT_FAILURE;
+                        continue;
+                }
+
+                if(eq_pos != arg.npos)
+                {
+                        shell_vars.set(name, std::string(arg.substr(eq_pos + 1)));
+                }
+
+                shell_vars.set_exported(name, !unexport);
+        }
+
+        return ret;
+}
+
+int unset(const args_t& args)
+{
+        const std::size_t len = args.size();
+        for(std::size_t i = 1; i < len; ++i)
+        {
+                shell_vars.unset(args[i]);
+        }
 
         return EXIT_SUCCESS;
 }
 
+int printf_(const args_t& args)
+{
+        const std::size_t len = args.size();
+
+        std::string_view var_name;
+        std::size_t fmt_pos = 1;
+        if(len > 2 && args[1] == "-v")
+        {
+                var_name = args[2];
+                fmt_pos = 3;
+        }
+
+        if(len > fmt_pos && args[fmt_pos] == "--")
+        {
+                ++fmt_pos;
+        }
+
+        if(len <= fmt_pos || (!var_name.empty() && !is_valid_name(var_name)))
+        {
+                print_err_fmt("shellter: printf usage: printf [-v VARNAME] FORMAT [ARGUMENT]...\n");
+                return EXIT_FAILURE;
+        }
+
+        const std::vector<std::string_view> fmt_args(args.begin() + static_cast<std::ptrdiff_t>(fmt_pos) + 1,
+                                                     args.end());
+        std::string result;
+        const bool ok = PrintfFormat::format(args[fmt_pos], fmt_args, result);
+
+        if(!var_name.empty())
+        {
+                shell_vars.set(var_name, std::move(result));
+                return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        FdWriter out(STDOUT_FILENO);
+        out.append(result);
+
+        return (out.flush() && ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int test(const args_t& args)
+{
+        const std::vector<std::string_view> operands(args.begin() + 1, args.end());
+        return Condition::evaluate(operands, "test");
+}
+
+/* '[', which needs a closing ']' */
+int bracket(const args_t& args)
+{
+        if(args.back() != "]")
+        {
+                print_err_fmt("shellter: [: missing ']'\n");
+                return Condition::ERROR;
+        }
+
+        const std::vector<std::string_view> operands(args.begin() + 1, args.end() - 1);
+        return Condition::evaluate(operands, "[");
+}
+
 int quit(const args_t& args)
 {
         const std::size_t len = args.size();
@@ -161,17 +494,865 @@ int quit(const args_t& args)
         return EXIT_SUCCESS;
 }
 
-} // namespace builtins
+/* 'return [N]': leaves the function or sourced script that's running, with
+ * status N or the status of the last command */
+int return_(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(function_depth == 0 && source_depth == 0)
+        {
+                print_err_fmt("shellter: return: can only return from a function or sourced script\n");
+                return EXIT_FAILURE;
+        }
 
-using builtin_func_t = int (*)(const builtins::args_t&);
+        int status = last_status;
+        if(len > 2 || (len == 2 && std::from_chars(args[1].data(), args[1].data() + args[1].size(),
+                                                   status).ptr != args[1].data() + args[1].size()))
+        {
+                print_err_fmt("shellter: return usage: return [N]\n");
+                return EXIT_FAILURE;
+        }
 
-static const std::unordered_map<std::string_view, builtin_func_t> builtin_funcs = {
-    { "cd",      &builtins::cd      },
-    { "echo",    &builtins::echo    },
-    { "exit",    &builtins::exit    },
-    { "pwd",     &builtins::pwd     },
-    { "history", &builtins::history },
-    { "addenv",  &builtins::addenv  },
-    { "eaddenv", &builtins::eaddenv },
-    { "quit",    &builtins::quit    }
+        function_returning = true;
+
+        return status & 0xff;
+}
+
+/* 'local NAME[=VALUE]...': variables that only exist until the function returns */
+int local(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(function_depth == 0)
+        {
+                print_err_fmt("shellter: local: can only be used in a function\n");
+                return EXIT_FAILURE;
+        }
+
+        int ret = EXIT_SUCCESS;
+        for(std::size_t i = 1; i < len; ++i)
+        {
+                const std::string_view arg = args[i];
+                const auto eq_pos = arg.find('=');
+                const auto name = arg.substr(0, eq_pos);
+
+                if(!is_valid_name(name))
+                {
+                        print_err_fmt("shellter: local: not a valid name: '{}'\n", name);
+                        ret = EXIT_FAILURE;
+                        continue;
+                }
+
+                shell_vars.set_local(name, (eq_pos != arg.npos) ? std::string(arg.substr(eq_pos + 1))
+                                                                : std::string());
+        }
+
+        return ret;
+}
+
+/* 'alias [NAME[=VALUE]]...': without a value, prints the alias */
+int alias(const args_t& args)
+{
+        const std::size_t len = args.size();
+
+        FdWriter out(STDOUT_FILENO);
+        const auto print_alias = [&](const std::string_view name)
+        {
+                /* quoted, so the output can be read back */
+                std::string value;
+                for(const char c : Aliases::find(name)->value)
+                {
+                        value.append((c == '\'') ? std::string_view("'\\''") : std::string_view(&c, 1));
+                }
+
+                out.print("alias {}='{}'\n", name, value);
+        };
+
+        if(len == 1)
+        {
+                for(const auto name : Aliases::names())
+                {
+                        print_alias(name);
+                }
+
+                return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        int ret = EXIT_SUCCESS;
+        for(std::size_t i = 1; i < len; ++i)
+        {
+                const std::string_view arg = args[i];
+                const auto eq_pos = arg.find('=');
+                const auto name = arg.substr(0, eq_pos);
+
+                if(eq_pos == arg.npos)
+                {
+                        if(Aliases::find(name) == nullptr)
+                        {
+                                print_err_fmt("shellter: alias: {}: not found\n", name);
+                                ret = EXIT_FAILURE;
+                                continue;
+                        }
+
+                        print_alias(name);
+                        continue;
+                }
+
+                if(!Aliases::is_valid_alias_name(name))
+                {
+                        print_err_fmt("shellter: alias: not a valid alias name: '{}'\n", name);
+                        ret = EXIT_FAILURE;
+                        continue;
+                }
+
+                if(!Aliases::define(name, arg.substr(eq_pos + 1)))
+                {
+                        print_err_fmt("shellter: alias: {}: unterminated quote in value\n", name);
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return out.flush() ? ret : EXIT_FAILURE;
+}
+
+int unalias(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(len == 1)
+        {
+                print_err_fmt("shellter: unalias usage: unalias [-a] NAME...\n");
+                return EXIT_FAILURE;
+        }
+
+        if(args[1] == "-a")
+        {
+                Aliases::clear();
+                return EXIT_SUCCESS;
+        }
+
+        int ret = EXIT_SUCCESS;
+        for(std::size_t i = 1; i < len; ++i)
+        {
+                if(!Aliases::remove(args[i]))
+                {
+                        print_err_fmt("shellter: unalias: {}: not found\n", args[i]);
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return ret;
+}
+
+/* 'true', 'false' and ':'; any arguments are ignored */
+int true_(const args_t&)
+{
+        return EXIT_SUCCESS;
+}
+
+int false_(const args_t&)
+{
+        return EXIT_FAILURE;
+}
+
+/* the options of dirname and realpath, none of which takes a value; returns
+ * the index of the first operand, or nothing after reporting a bad option */
+static std::optional<std::size_t> parse_flags(const args_t& args, const std::string_view allowed,
+                                              std::string& flags)
+{
+        std::size_t i = 1;
+        for(; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i)
+        {
+                if(args[i] == "--")
+                {
+                        return i + 1;
+                }
+
+                for(const char c : std::string_view(args[i]).substr(1))
+                {
+                        if(allowed.find(c) == allowed.npos)
+                        {
+                                print_err_fmt("shellter: {}: invalid option -- '{}'\n", args[0], c);
+                                return std::nullopt;
+                        }
+
+                        flags.push_back(c);
+                }
+        }
+
+        return i;
+}
+
+/* 'basename NAME [SUFFIX]', 'basename [-az] [-s SUFFIX] NAME...' */
+int basename(const args_t& args)
+{
+        std::string flags;
+        std::string suffix;
+        std::size_t i = 1;
+        for(; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i)
+        {
+                if(args[i] == "--")
+                {
+                        ++i;
+                        break;
+                }
+
+                if(args[i] == "-s" && i + 1 < args.size())
+                {
+                        suffix = args[++i];
+                        flags.push_back('a');
+                        continue;
+                }
+
+                for(const char c : std::string_view(args[i]).substr(1))
+                {
+                        if(c != 'a' && c != 'z')
+                        {
+                                print_err_fmt("shellter: basename: invalid option -- '{}'\n", c);
+                                return EXIT_FAILURE;
+                        }
+
+                        flags.push_back(c);
+                }
+        }
+
+        const bool multiple = (flags.find('a') != flags.npos);
+        const std::size_t len = args.size();
+        if(i == len)
+        {
+                print_err_fmt("shellter: basename: missing operand\n");
+                return EXIT_FAILURE;
+        }
+
+        std::size_t last = len;
+        if(!multiple)
+        {
+                if(len - i > 2)
+                {
+                        print_err_fmt("shellter: basename: extra operand '{}'\n", args[i + 2]);
+                        return EXIT_FAILURE;
+                }
+
+                suffix = (len - i == 2) ? args[i + 1] : "";
+                last = i + 1;
+        }
+
+        const char delim = (flags.find('z') != flags.npos) ? '\0' : '\n';
+        FdWriter out(STDOUT_FILENO);
+        for(; i < last; ++i)
+        {
+                std::string_view name = args[i];
+
+                /* trailing slashes don't count; a name made of slashes is '/' */
+                const auto end = name.find_last_not_of('/');
+                if(end == name.npos)
+                {
+                        out.append(name.empty() ? "" : "/");
+                        out.append(delim);
+                        continue;
+                }
+
+                name = name.substr(0, end + 1);
+                name = name.substr(name.rfind('/') + 1);
+                if(!suffix.empty() && name != suffix && name.ends_with(suffix))
+                {
+                        name.remove_suffix(suffix.size());
+                }
+
+                out.append(name);
+                out.append(delim);
+        }
+
+        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* 'dirname [-z] NAME...' */
+int dirname(const args_t& args)
+{
+        std::string flags;
+        const auto first = parse_flags(args, "z", flags);
+        if(!first.has_value())
+        {
+                return EXIT_FAILURE;
+        }
+
+        if(*first == args.size())
+        {
+                print_err_fmt("shellter: dirname: missing operand\n");
+                return EXIT_FAILURE;
+        }
+
+        const char delim = flags.empty() ? '\n' : '\0';
+        FdWriter out(STDOUT_FILENO);
+        for(std::size_t i = *first; i < args.size(); ++i)
+        {
+                const std::string_view name = args[i];
+
+                /* the name without its last component and the slashes around it */
+                const auto end = name.find_last_not_of('/');
+                const auto slash = (end == name.npos) ? name.npos : name.rfind('/', end);
+                if(end == name.npos)
+                {
+                        out.append(name.empty() ? "." : "/");
+                }
+                else if(slash == name.npos)
+                {
+                        out.append('.');
+                }
+                else
+                {
+                        const auto dir_end = name.find_last_not_of('/', slash);
+                        out.append((dir_end == name.npos) ? "/" : name.substr(0, dir_end + 1));
+                }
+
+                out.append(delim);
+        }
+
+        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* 'realpath [-e|-m] [-sqz] FILE...': by default, all but the last component
+ * must exist; -e wants all of them, -m none; -s leaves symlinks alone */
+int realpath(const args_t& args)
+{
+        std::string flags;
+        const auto first = parse_flags(args, "emsqz", flags);
+        if(!first.has_value())
+        {
+                return EXIT_FAILURE;
+        }
+
+        if(*first == args.size())
+        {
+                print_err_fmt("shellter: realpath: missing operand\n");
+                return EXIT_FAILURE;
+        }
+
+        const auto has = [&](const char c)
+        {
+                return flags.find(c) != flags.npos;
+        };
+
+        int ret = EXIT_SUCCESS;
+        FdWriter out(STDOUT_FILENO);
+        for(std::size_t i = *first; i < args.size(); ++i)
+        {
+                const fs::path name = args[i];
+                std::error_code ec;
+
+                fs::path resolved;
+                if(name.empty())
+                {
+                        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+                }
+                else if(has('s'))
+                {
+                        resolved = fs::absolute(name, ec).lexically_normal();
+                }
+                else if(has('e'))
+                {
+                        resolved = fs::canonical(name, ec);
+                }
+                else if(has('m'))
+                {
+                        resolved = fs::weakly_canonical(fs::absolute(name, ec), ec);
+                }
+                else
+                {
+                        /* the last component may be missing, but not its directory */
+                        resolved = fs::canonical(name, ec);
+                        const auto filename = name.filename();
+                        if(ec == std::errc::no_such_file_or_directory && filename != "." && filename != ".." &&
+                           !filename.empty())
+                        {
+                                const auto parent = name.has_parent_path() ? name.parent_path() : fs::path(".");
+                                resolved = fs::canonical(parent, ec) / filename;
+                        }
+                }
+
+                if(ec)
+                {
+                        if(!has('q'))
+                        {
+                                out.flush();
+                                print_err_fmt("shellter: realpath: {}: {}\n", args[i], ec.message());
+                        }
+                        ret = EXIT_FAILURE;
+                        continue;
+                }
+
+                std::string_view str = resolved.native();
+                while(str.size() > 1 && str.ends_with('/'))
+                {
+                        str.remove_suffix(1);
+                }
+
+                out.append(str);
+                out.append(has('z') ? '\0' : '\n');
+        }
+
+        return (out.flush() && ret == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* 'sleep NUMBER[SUFFIX]...': the intervals add up; the suffix is one of
+ * s (the default), m, h and d */
+int sleep(const args_t& args)
+{
+        if(args.size() == 1)
+        {
+                print_err_fmt("shellter: sleep: missing operand\n");
+                return EXIT_FAILURE;
+        }
+
+        double seconds = 0;
+        for(std::size_t i = 1; i < args.size(); ++i)
+        {
+                std::string_view arg = args[i];
+
+                static constexpr std::string_view suffixes = "smhd";
+                static constexpr std::array<double, 4> multipliers = {1, 60, 60 * 60, 24 * 60 * 60};
+
+                double multiplier = 1;
+                const auto suffix_pos = arg.empty() ? suffixes.npos : suffixes.find(arg.back());
+                if(suffix_pos != suffixes.npos && arg != "inf" && arg != "infinity")
+                {
+                        multiplier = multipliers[suffix_pos];
+                        arg.remove_suffix(1);
+                }
+
+                double value = 0;
+                const auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+                if(arg.empty() || ec != std::errc() || ptr != arg.data() + arg.size() || !(value >= 0))
+                {
+                        print_err_fmt("shellter: sleep: invalid time interval '{}'\n", args[i]);
+                        return EXIT_FAILURE;
+                }
+
+                seconds += value * multiplier;
+        }
+
+        /* sleeps until a deadline, so that other signals caught in the process
+         * neither cut the interval short nor stretch it; Ctrl-C ends it */
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+        constexpr double MAX_SECONDS = static_cast<double>(std::numeric_limits<std::int32_t>::max());
+        const double whole = std::floor(std::min(seconds, MAX_SECONDS));
+        deadline.tv_sec += static_cast<time_t>(whole);
+        deadline.tv_nsec += static_cast<long>((std::min(seconds, MAX_SECONDS) - whole) * 1e9);
+        if(deadline.tv_nsec >= 1'000'000'000)
+        {
+                ++deadline.tv_sec;
+                deadline.tv_nsec -= 1'000'000'000;
+        }
+
+        interrupted = 0;
+        while(true)
+        {
+                const int err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+                if(err == 0)
+                {
+                        return EXIT_SUCCESS;
+                }
+
+                if(err == EINTR)
+                {
+                        if(interrupted)
+                        {
+                                return 128 + SIGINT;
+                        }
+
+                        continue;
+                }
+
+                print_err_fmt("shellter: sleep: {}\n", strerror(err));
+                return EXIT_FAILURE;
+        }
+}
+
+static constexpr std::array<std::pair<std::string_view, int>, 31> signal_names = {{
+    {"HUP", SIGHUP},       {"INT", SIGINT},     {"QUIT", SIGQUIT},   {"ILL", SIGILL},     {"TRAP", SIGTRAP},
+    {"ABRT", SIGABRT},     {"BUS", SIGBUS},     {"FPE", SIGFPE},     {"KILL", SIGKILL},   {"USR1", SIGUSR1},
+    {"SEGV", SIGSEGV},     {"USR2", SIGUSR2},   {"PIPE", SIGPIPE},   {"ALRM", SIGALRM},   {"TERM", SIGTERM},
+    {"STKFLT", SIGSTKFLT}, {"CHLD", SIGCHLD},   {"CONT", SIGCONT},   {"STOP", SIGSTOP},   {"TSTP", SIGTSTP},
+    {"TTIN", SIGTTIN},     {"TTOU", SIGTTOU},   {"URG", SIGURG},     {"XCPU", SIGXCPU},   {"XFSZ", SIGXFSZ},
+    {"VTALRM", SIGVTALRM}, {"PROF", SIGPROF},   {"WINCH", SIGWINCH}, {"IO", SIGIO},       {"PWR", SIGPWR},
+    {"SYS", SIGSYS}
+}};
+
+/* a signal by number or by name, with or without 'SIG' */
+static std::optional<int> parse_signal(std::string_view sv)
+{
+        int num = 0;
+        const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), num);
+        if(!sv.empty() && ec == std::errc() && ptr == sv.data() + sv.size())
+        {
+                return (num >= 0 && num < NSIG) ? std::optional(num) : std::nullopt;
+        }
+
+        if(sv.starts_with("SIG"))
+        {
+                sv.remove_prefix(3);
+        }
+
+        for(const auto& [name, sig] : signal_names)
+        {
+                if(boost::iequals(name, sv))
+                {
+                        return sig;
+                }
+        }
+
+        return std::nullopt;
+}
+
+/* 'kill [-s SIGNAL | -SIGNAL] PID...', 'kill -l [STATUS]' */
+int kill(const args_t& args)
+{
+        const std::size_t len = args.size();
+        int sig = SIGTERM;
+        std::size_t i = 1;
+
+        if(len > 1 && args[1] == "-l")
+        {
+                FdWriter out(STDOUT_FILENO);
+                if(len == 2)
+                {
+                        for(const auto& [name, num] : signal_names)
+                        {
+                                out.print("{}\n", name);
+                        }
+                        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+
+                /* a status like $? of a killed command gives its signal */
+                int num = 0;
+                const auto [ptr, ec] = std::from_chars(args[2].data(), args[2].data() + args[2].size(), num);
+                const auto sig = (ec == std::errc() && ptr == args[2].data() + args[2].size())
+                                     ? std::optional(num & 0x7f)
+                                     : parse_signal(args[2]);
+                const auto found = std::find_if(signal_names.begin(), signal_names.end(), [&](const auto& entry)
+                                                {
+                                                        return sig.has_value() && entry.second == *sig;
+                                                });
+                if(found == signal_names.end())
+                {
+                        print_err_fmt("shellter: kill: {}: invalid signal specification\n", args[2]);
+                        return EXIT_FAILURE;
+                }
+
+                out.print("{}\n", found->first);
+                return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if(len > 2 && (args[1] == "-s" || args[1] == "-n"))
+        {
+                i = 3;
+        }
+        else if(len > 1 && args[1].size() > 1 && args[1][0] == '-' && args[1] != "--")
+        {
+                i = 2;
+        }
+
+        if(i > 1)
+        {
+                const std::string_view spec = (i == 3) ? std::string_view(args[2]) : std::string_view(args[1]).substr(1);
+                const auto parsed = parse_signal(spec);
+                if(!parsed.has_value())
+                {
+                        print_err_fmt("shellter: kill: {}: invalid signal specification\n", spec);
+                        return EXIT_FAILURE;
+                }
+                sig = *parsed;
+        }
+
+        if(i < len && args[i] == "--")
+        {
+                ++i;
+        }
+
+        if(i == len)
+        {
+                print_err_fmt("shellter: kill usage: kill [-s SIGNAL | -SIGNAL] PID... or kill -l [STATUS]\n");
+                return 2;
+        }
+
+        int ret = EXIT_SUCCESS;
+        for(; i < len; ++i)
+        {
+                pid_t pid = 0;
+                const auto [ptr, ec] = std::from_chars(args[i].data(), args[i].data() + args[i].size(), pid);
+                if(ec != std::errc() || ptr != args[i].data() + args[i].size())
+                {
+                        print_err_fmt("shellter: kill: {}: arguments must be process IDs\n", args[i]);
+                        ret = EXIT_FAILURE;
+                        continue;
+                }
+
+                if(::kill(pid, sig) < 0)
+                {
+                        print_err_fmt("shellter: kill: ({}) - {}\n", pid, strerror(errno));
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return ret;
+}
+
+/* 'umask [-S] [MODE]': MODE is octal, or symbolic like 'u=rwx,g=rx,o=' where
+ * the permissions are the ones left allowed */
+int umask(const args_t& args)
+{
+        const std::size_t len = args.size();
+        const bool symbolic = (len > 1 && args[1] == "-S");
+        const std::size_t first = symbolic ? 2 : 1;
+
+        const mode_t current = ::umask(0);
+        ::umask(current);
+
+        if(len == first)
+        {
+                FdWriter out(STDOUT_FILENO);
+                if(!symbolic)
+                {
+                        out.print("{:04o}\n", current);
+                        return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+
+                const mode_t allowed = ~current & 0777;
+                const auto perms = [&](const int shift)
+                {
+                        std::string str;
+                        const mode_t bits = (allowed >> shift) & 7;
+                        str += (bits & 4) ? "r" : "";
+                        str += (bits & 2) ? "w" : "";
+                        str += (bits & 1) ? "x" : "";
+                        return str;
+                };
+                out.print("u={},g={},o={}\n", perms(6), perms(3), perms(0));
+                return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if(len > first + 1)
+        {
+                print_err_fmt("shellter: umask: too many arguments\n");
+                return EXIT_FAILURE;
+        }
+
+        const std::string_view mode = args[first];
+        const auto invalid = [&]()
+        {
+                print_err_fmt("shellter: umask: {}: invalid mode\n", mode);
+                return EXIT_FAILURE;
+        };
+
+        if(!mode.empty() && mode.find_first_not_of("01234567") == mode.npos)
+        {
+                unsigned int value = 0;
+                std::from_chars(mode.data(), mode.data() + mode.size(), value, 8);
+                if(value > 0777)
+                {
+                        return invalid();
+                }
+
+                ::umask(static_cast<mode_t>(value));
+                return EXIT_SUCCESS;
+        }
+
+        /* clauses like 'ug+w', applied in order to the allowed permissions */
+        mode_t allowed = ~current & 0777;
+        std::vector<std::string> clauses;
+        boost::split(clauses, mode, boost::is_any_of(","));
+        for(const std::string_view clause : clauses)
+        {
+                const auto op_pos = clause.find_first_of("=+-");
+                if(op_pos == clause.npos)
+                {
+                        return invalid();
+                }
+
+                mode_t who = 0;
+                for(const char c : clause.substr(0, op_pos))
+                {
+                        const auto pos = std::string_view("ogua").find(c);
+                        if(pos == std::string_view::npos)
+                        {
+                                return invalid();
+                        }
+                        who |= (pos == 3) ? 0777 : (07 << (3 * pos));
+                }
+                who = (who == 0) ? 0777 : who;
+
+                mode_t bits = 0;
+                for(const char c : clause.substr(op_pos + 1))
+                {
+                        const auto pos = std::string_view("xwr").find(c);
+                        if(pos == std::string_view::npos)
+                        {
+                                return invalid();
+                        }
+                        bits |= 0111 << pos;
+                }
+                bits &= who;
+
+                switch(clause[op_pos])
+                {
+                case '=':
+                        allowed = (allowed & ~who) | bits;
+                        break;
+                case '+':
+                        allowed |= bits;
+                        break;
+                default:
+                        allowed &= ~bits;
+                        break;
+                }
+        }
+
+        ::umask(~allowed & 0777);
+        return EXIT_SUCCESS;
+}
+
+/* 'enable -f FILE NAME...' loads builtins from a shared object, 'enable -d NAME...'
+ * removes them and 'enable' lists them */
+int enable(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(len == 1)
+        {
+                FdWriter out(STDOUT_FILENO);
+                LoadableBuiltins::list(out);
+                return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        const bool loading = (args[1] == "-f" && len > 3);
+        if(!loading && (args[1] != "-d" || len < 3))
+        {
+                print_err_fmt("shellter: enable usage: enable [-f FILE NAME... | -d NAME...]\n");
+                return 2;
+        }
+
+        int ret = EXIT_SUCCESS;
+        for(std::size_t i = loading ? 3 : 2; i < len; ++i)
+        {
+                if(loading && !LoadableBuiltins::load(args[2], args[i]))
+                {
+                        ret = EXIT_FAILURE;
+                }
+                else if(!loading && !LoadableBuiltins::remove(args[i]))
+                {
+                        print_err_fmt("shellter: enable: {}: not a loaded builtin\n", args[i]);
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return ret;
+}
+
+/* 'source FILE [ARG]...' and '. FILE [ARG]...': runs a script in the current
+ * shell; it needs the compiler, so it's defined in source.h */
+int source(const args_t& args);
+
+int setopt(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(len == 1)
+        {
+                FdWriter out(STDOUT_FILENO);
+                out.print("pipesize {}\n", shell_options.pipe_size);
+                out.print("argbatch {}\n", shell_options.arg_batching ? "on" : "off");
+
+                return out.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if(args[1] == "pipesize")
+        {
+                const auto opt_size = (len == 3) ? parse_size(args[2]) : std::nullopt;
+                if(!opt_size.has_value())
+                {
+                        print_err_fmt("shellter: setopt usage: setopt pipesize SIZE\n");
+                        return EXIT_FAILURE;
+                }
+
+                shell_options.pipe_size = *opt_size;
+                return EXIT_SUCCESS;
+        }
+
+        /* run external commands several times rather than fail with E2BIG */
+        if(args[1] == "argbatch" && len == 2)
+        {
+                shell_options.arg_batching = true;
+                return EXIT_SUCCESS;
+        }
+
+        print_err_fmt("shellter: setopt: no such option: {}\n", args[1]);
+        return EXIT_FAILURE;
+}
+
+int unsetopt(const args_t& args)
+{
+        const std::size_t len = args.size();
+        if(len != 2)
+        {
+                print_err_fmt("shellter: unsetopt usage: unsetopt OPTION\n");
+                return EXIT_FAILURE;
+        }
+
+        if(args[1] == "pipesize")
+        {
+                shell_options.pipe_size = 0;
+                return EXIT_SUCCESS;
+        }
+
+        if(args[1] == "argbatch")
+        {
+                shell_options.arg_batching = false;
+                return EXIT_SUCCESS;
+        }
+
+        print_err_fmt("shellter: unsetopt: no such option: {}\n", args[1]);
+        return EXIT_FAILURE;
+}
+
+} // namespace builtins
+
+using builtin_func_t = int (*)(const builtins::args_t&);
+
+static const std::unordered_map<std::string_view, builtin_func_t> builtin_funcs = {
+    { "cd",       &builtins::cd       },
+    { "echo",     &builtins::echo     },
+    { "exit",     &builtins::exit     },
+    { "pwd",      &builtins::pwd      },
+    { "history",  &builtins::history  },
+    { "addenv",   &builtins::addenv   },
+    { "eaddenv",  &builtins::eaddenv  },
+    { "quit",     &builtins::quit     },
+    { "export",   &builtins::export_  },
+    { "unset",    &builtins::unset    },
+    { "mapfile",  &builtins::mapfile  },
+    { "read",     &builtins::read     },
+    { "printf",   &builtins::printf_  },
+    { "test",     &builtins::test     },
+    { "[",        &builtins::bracket  },
+    { "return",   &builtins::return_  },
+    { "local",    &builtins::local    },
+    { "alias",    &builtins::alias    },
+    { "unalias",  &builtins::unalias  },
+    { "source",   &builtins::source   },
+    { "enable",   &builtins::enable   },
+    { "true",     &builtins::true_    },
+    { "false",    &builtins::false_   },
+    { ":",        &builtins::true_    },
+    { "basename", &builtins::basename },
+    { "dirname",  &builtins::dirname  },
+    { "realpath", &builtins::realpath },
+    { "sleep",    &builtins::sleep    },
+    { "kill",     &builtins::kill     },
+    { "umask",    &builtins::umask    },
+    { ".",        &builtins::source   },
+    { "setopt",   &builtins::setopt   },
+    { "unsetopt", &builtins::unsetopt }
+};
+
+/* builtins that only save a fork: 'command NAME' runs the program from PATH */
+static const std::unordered_set<std::string_view> utility_builtins = {
+    "true", "false", "basename", "dirname", "realpath", "sleep", "kill"
 };
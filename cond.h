@@ -0,0 +1,491 @@
+/* conditional expressions, as evaluated by 'test' and '['
+ *
+ * file predicates go through a small cache of stat() results, so that e.g.
+ * '[ -f F -a -r F ]' stats F once; the cache lives for one command and is
+ * dropped before the next one, which may run after the file system changed */
+class StatCache
+{
+public:
+        struct Entry
+        {
+                std::string path;
+                bool follow = true; /* stat() or lstat() */
+                int error = 0;      /* errno of a failed call */
+                struct stat st;
+        };
+
+        /* returns null if the file can't be stat()ed */
+        static const struct stat* lookup(const std::string_view path, const bool follow)
+        {
+                for(std::size_t i = 0; i < used; ++i)
+                {
+                        const Entry& entry = entries[i];
+                        if(entry.follow == follow && entry.path == path)
+                        {
+                                return (entry.error == 0) ? &entry.st : nullptr;
+                        }
+                }
+
+                /* replace entries round robin once the cache is full */
+                Entry& entry = entries[next];
+                next = (next + 1) % CACHE_SIZE;
+                used = std::max(used, next == 0 ? CACHE_SIZE : next);
+
+                entry.path.assign(path);
+                entry.follow = follow;
+                const int ret = follow ? stat(entry.path.c_str(), &entry.st)
+                                       : lstat(entry.path.c_str(), &entry.st);
+                entry.error = (ret < 0) ? errno : 0;
+
+                return (entry.error == 0) ? &entry.st : nullptr;
+        }
+
+        static void invalidate()
+        {
+                used = 0;
+                next = 0;
+        }
+
+private:
+        static constexpr std::size_t CACHE_SIZE = 8;
+
+        static std::array<Entry, CACHE_SIZE> entries;
+        static std::size_t used;
+        static std::size_t next;
+};
+
+std::array<StatCache::Entry, StatCache::CACHE_SIZE> StatCache::entries = {};
+std::size_t StatCache::used = 0;
+std::size_t StatCache::next = 0;
+
+class Condition
+{
+public:
+        static constexpr int TRUE = 0;
+        static constexpr int FALSE = 1;
+        static constexpr int ERROR = 2;
+
+        /* evaluates the expression formed by 'args'; prints a diagnostic and
+         * returns ERROR on syntax errors. 'extended' is for '[[ ... ]]': '&&'
+         * and '||' instead of '-a' and '-o', patterns on the right of '==' and
+         * '!=', and '=~', which stores the match and its groups in MATCH */
+        static int evaluate(const std::vector<std::string_view>& args, const std::string_view cmd,
+                            const bool extended = false)
+        {
+                Condition cond(args, cmd, extended);
+                if(extended)
+                {
+                        return cond.evaluate_all();
+                }
+
+                /* the POSIX rules for up to four arguments, which disambiguate
+                 * things like '[ ! = x ]' and '[ -f ]' */
+                std::optional<bool> result;
+                switch(args.size())
+                {
+                case 0:
+                        return FALSE;
+                case 1:
+                        return args[0].empty() ? FALSE : TRUE;
+                case 2:
+                        if(args[0] == "!")
+                        {
+                                return args[1].empty() ? TRUE : FALSE;
+                        }
+                        break;
+                case 3:
+                        if(cond.is_binary(args[1]))
+                        {
+                                result = cond.binary(args[0], args[1], args[2]);
+                                return to_status(result);
+                        }
+                        if(args[0] == "!")
+                        {
+                                result = cond.unary_or_string(1);
+                                return to_status(result.has_value() ? std::optional(!*result) : result);
+                        }
+                        if(args[0] == "(" && args[2] == ")")
+                        {
+                                return args[1].empty() ? FALSE : TRUE;
+                        }
+                        break;
+                case 4:
+                        if(args[0] == "!" && cond.is_binary(args[2]))
+                        {
+                                result = cond.binary(args[1], args[2], args[3]);
+                                return to_status(result.has_value() ? std::optional(!*result) : result);
+                        }
+                        break;
+                default:
+                        break;
+                }
+
+                return cond.evaluate_all();
+        }
+
+private:
+        Condition(const std::vector<std::string_view>& args, const std::string_view cmd, const bool extended)
+            : args(args)
+            , cmd(cmd)
+            , extended(extended)
+        {
+        }
+
+        int evaluate_all()
+        {
+                const auto result = parse_or();
+                if(result.has_value() && pos != args.size())
+                {
+                        return error("unexpected argument '{}'", args[pos]);
+                }
+
+                return to_status(result);
+        }
+
+        static int to_status(const std::optional<bool> result)
+        {
+                if(!result.has_value())
+                {
+                        return ERROR;
+                }
+
+                return *result ? TRUE : FALSE;
+        }
+
+        int error(auto&& str, auto&&... fmt_args)
+        {
+                print_err_fmt("shellter: {}: {}\n", cmd,
+                              fmt::format(fmt::runtime(str), std::forward<decltype(fmt_args)>(fmt_args)...));
+                return ERROR;
+        }
+
+        static bool is_unary(const std::string_view op)
+        {
+                return op.size() == 2 && op[0] == '-' &&
+                       std::string_view("bcdefghkLnprsStuwxzGO").find(op[1]) != op.npos;
+        }
+
+        bool is_binary(const std::string_view op) const
+        {
+                static constexpr std::array<std::string_view, 14> ops = {
+                    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+
+                return std::find(ops.begin(), ops.end(), op) != ops.end() || (extended && op == "=~");
+        }
+
+        /* expr := and ( '-o' and )* */
+        std::optional<bool> parse_or()
+        {
+                const std::string_view or_op = extended ? "||" : "-o";
+
+                auto lhs = parse_and();
+                while(lhs.has_value() && pos < args.size() && args[pos] == or_op)
+                {
+                        ++pos;
+                        const auto rhs = parse_and();
+                        if(!rhs.has_value())
+                        {
+                                return std::nullopt;
+                        }
+                        lhs = *lhs || *rhs;
+                }
+
+                return lhs;
+        }
+
+        /* and := not ( '-a' not )* */
+        std::optional<bool> parse_and()
+        {
+                const std::string_view and_op = extended ? "&&" : "-a";
+
+                auto lhs = parse_not();
+                while(lhs.has_value() && pos < args.size() && args[pos] == and_op)
+                {
+                        ++pos;
+                        const auto rhs = parse_not();
+                        if(!rhs.has_value())
+                        {
+                                return std::nullopt;
+                        }
+                        lhs = *lhs && *rhs;
+                }
+
+                return lhs;
+        }
+
+        /* not := '!' not | primary */
+        std::optional<bool> parse_not()
+        {
+                if(pos < args.size() && args[pos] == "!")
+                {
+                        ++pos;
+                        const auto operand = parse_not();
+                        return operand.has_value() ? std::optional(!*operand) : operand;
+                }
+
+                return parse_primary();
+        }
+
+        std::optional<bool> parse_primary()
+        {
+                if(pos >= args.size())
+                {
+                        error("argument expected");
+                        return std::nullopt;
+                }
+
+                if(args[pos] == "(" && !(pos + 1 < args.size() && is_binary(args[pos + 1])))
+                {
+                        ++pos;
+                        const auto result = parse_or();
+                        if(!result.has_value())
+                        {
+                                return std::nullopt;
+                        }
+
+                        if(pos >= args.size() || args[pos] != ")")
+                        {
+                                error("')' expected");
+                                return std::nullopt;
+                        }
+
+                        ++pos;
+                        return result;
+                }
+
+                if(pos + 2 < args.size() && is_binary(args[pos + 1]))
+                {
+                        pos += 3;
+                        return binary(args[pos - 3], args[pos - 2], args[pos - 1]);
+                }
+
+                const auto result = unary_or_string(pos);
+                pos += (is_unary(args[pos]) && pos + 1 < args.size()) ? 2 : 1;
+                return result;
+        }
+
+        /* a unary predicate at 'i', or a lone string */
+        std::optional<bool> unary_or_string(const std::size_t i)
+        {
+                if(is_unary(args[i]) && i + 1 < args.size())
+                {
+                        return unary(args[i][1], args[i + 1]);
+                }
+
+                return !args[i].empty();
+        }
+
+        std::optional<bool> unary(const char op, const std::string_view operand)
+        {
+                switch(op)
+                {
+                case 'z':
+                        return operand.empty();
+                case 'n':
+                        return !operand.empty();
+                case 't':
+                {
+                        const auto fd = to_integer(operand);
+                        if(!fd.has_value())
+                        {
+                                return std::nullopt;
+                        }
+                        return *fd >= 0 && *fd <= INT_MAX && isatty(static_cast<int>(*fd));
+                }
+                case 'r':
+                case 'w':
+                case 'x':
+                {
+                        /* permissions depend on more than the mode bits */
+                        const int mode = (op == 'r') ? R_OK : (op == 'w') ? W_OK : X_OK;
+                        return StatCache::lookup(operand, true) != nullptr &&
+                               access(std::string(operand).c_str(), mode) == 0;
+                }
+                default:
+                        break;
+                }
+
+                const bool follow = (op != 'h' && op != 'L');
+                const struct stat* st = StatCache::lookup(operand, follow);
+                if(st == nullptr)
+                {
+                        return false;
+                }
+
+                switch(op)
+                {
+                case 'b':
+                        return S_ISBLK(st->st_mode);
+                case 'c':
+                        return S_ISCHR(st->st_mode);
+                case 'd':
+                        return S_ISDIR(st->st_mode);
+                case 'e':
+                        return true;
+                case 'f':
+                        return S_ISREG(st->st_mode);
+                case 'g':
+                        return (st->st_mode & S_ISGID) != 0;
+                case 'h':
+                case 'L':
+                        return S_ISLNK(st->st_mode);
+                case 'k':
+                        return (st->st_mode & S_ISVTX) != 0;
+                case 'p':
+                        return S_ISFIFO(st->st_mode);
+                case 's':
+                        return st->st_size > 0;
+                case 'S':
+                        return S_ISSOCK(st->st_mode);
+                case 'u':
+                        return (st->st_mode & S_ISUID) != 0;
+                case 'G':
+                        return st->st_gid == getegid();
+                case 'O':
+                        return st->st_uid == geteuid();
+                default:
+                        return false;
+                }
+        }
+
+        std::optional<bool> binary(const std::string_view lhs, const std::string_view op,
+                                   const std::string_view rhs)
+        {
+                if(extended && (op == "=" || op == "==" || op == "!="))
+                {
+                        const GlobPattern pattern(rhs);
+                        const bool matches = pattern.is_literal() ? (lhs == pattern.literal()) : pattern.match(lhs);
+                        return matches == (op != "!=");
+                }
+                if(op == "=~")
+                {
+                        return match_regex(lhs, rhs);
+                }
+                if(op == "=" || op == "==")
+                {
+                        return lhs == rhs;
+                }
+                if(op == "!=")
+                {
+                        return lhs != rhs;
+                }
+                if(op == "<")
+                {
+                        return lhs < rhs;
+                }
+                if(op == ">")
+                {
+                        return lhs > rhs;
+                }
+
+                if(op == "-nt" || op == "-ot" || op == "-ef")
+                {
+                        return compare_files(lhs, op, rhs);
+                }
+
+                const auto a = to_integer(lhs);
+                const auto b = to_integer(rhs);
+                if(!a.has_value() || !b.has_value())
+                {
+                        return std::nullopt;
+                }
+
+                switch(op[1])
+                {
+                case 'e':
+                        return *a == *b;
+                case 'n':
+                        return *a != *b;
+                case 'l':
+                        return (op[2] == 't') ? *a < *b : *a <= *b;
+                default:
+                        return (op[2] == 't') ? *a > *b : *a >= *b;
+                }
+        }
+
+        std::optional<bool> compare_files(const std::string_view lhs, const std::string_view op,
+                                          const std::string_view rhs)
+        {
+                /* copied out: the second lookup may evict the first entry */
+                struct stat a = {};
+                const struct stat* lhs_st = StatCache::lookup(lhs, true);
+                const bool a_exists = (lhs_st != nullptr);
+                if(a_exists)
+                {
+                        a = *lhs_st;
+                }
+                const struct stat* b = StatCache::lookup(rhs, true);
+
+                const auto mtime = [](const struct stat& st)
+                {
+                        return std::pair(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+                };
+
+                if(op == "-ef")
+                {
+                        return a_exists && b != nullptr && a.st_dev == b->st_dev && a.st_ino == b->st_ino;
+                }
+
+                /* an existing file is newer than a missing one */
+                if(op == "-nt")
+                {
+                        return a_exists && (b == nullptr || mtime(a) > mtime(*b));
+                }
+
+                return b != nullptr && (!a_exists || mtime(a) < mtime(*b));
+        }
+
+        /* POSIX extended regular expressions, like grep -E */
+        std::optional<bool> match_regex(const std::string_view str, const std::string_view pattern)
+        {
+                const boost::regex* regex = RegexCache::get(pattern, boost::regex::extended);
+                if(regex == nullptr)
+                {
+                        return std::nullopt;
+                }
+
+                boost::cmatch match;
+                const bool found = boost::regex_search(str.data(), str.data() + str.size(), match, *regex);
+
+                /* MATCH[0] is the matched text, MATCH[N] group N */
+                ShellArray groups;
+                if(found)
+                {
+                        for(const auto& group : match)
+                        {
+                                groups.push_back(group.matched ? std::string_view(group.first, group.length())
+                                                               : std::string_view());
+                        }
+                }
+                shell_vars.set_array("MATCH", std::move(groups));
+
+                return found;
+        }
+
+        std::optional<std::int64_t> to_integer(std::string_view sv)
+        {
+                const auto first = sv.find_first_not_of(" \t");
+                const auto last = sv.find_last_not_of(" \t");
+                sv = (first == sv.npos) ? std::string_view() : sv.substr(first, last - first + 1);
+
+                if(!sv.empty() && sv.front() == '+')
+                {
+                        sv.remove_prefix(1);
+                }
+
+                std::int64_t value = 0;
+                const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+                if(sv.empty() || ec != std::errc() || ptr != sv.data() + sv.size())
+                {
+                        error("{}: integer expression expected", sv);
+                        return std::nullopt;
+                }
+
+                return value;
+        }
+
+        const std::vector<std::string_view>& args;
+        const std::string_view cmd;
+        const bool extended;
+        std::size_t pos = 0;
+};
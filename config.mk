@@ -3,9 +3,11 @@ CPPSTD = -std=c++20
 WFLAGS = -Wall -Wextra -Wpedantic
 DEBUGFLAGS = ${CPPSTD} ${WFLAGS} -Og -march=native -fno-rtti
 RELEASEFLAGS = ${CPPSTD} ${WFLAGS} -Os -march=native -flto -fno-rtti -fno-exceptions
+# the interactive parts, main() included, are left out of the library
+LIBFLAGS = ${CPPSTD} ${WFLAGS} -O2 -march=native -fPIC -fno-rtti -DSHELLTER_LIBRARY
 
 #libs
-LIBS = -lboost_regex -lreadline
+LIBS = -lboost_regex -lreadline -pthread -ldl
 
 #compiler
 CPPC = g++
@@ -0,0 +1,180 @@
+/* the Shell of libshellter (see shellter.h)
+ *
+ * the interpreter works on the globals of the shell, so the state of a Shell
+ * is kept aside between runs and swapped with the globals for the length of
+ * each one */
+using namespace shellter::impl;
+
+struct shellter::Shell::State
+{
+        VariableStore vars;
+        std::vector<std::string> params = {"shellter"};
+        ShellOptions options;
+        ShellFunctions::table_t functions;
+        Aliases::table_t aliases;
+        fs::path cwd;
+        fs::path old_path;
+        bool old_path_set = false;
+        mode_t mask = 022;
+        int last_status = 0;
+};
+
+static std::mutex embedded_mutex;
+
+/* puts the state of a shell in place of the globals, and back when it's
+ * destroyed, along with the working directory and umask of the process */
+class ActiveShell
+{
+public:
+        explicit ActiveShell(shellter::Shell::State& state)
+            : state(state)
+        {
+                std::error_code ec;
+                host_cwd = fs::current_path(ec);
+                host_mask = umask(state.mask);
+                if(!state.cwd.empty())
+                {
+                        fs::current_path(state.cwd, ec);
+                }
+
+                swap();
+        }
+
+        ActiveShell(const ActiveShell&) = delete;
+        ActiveShell& operator=(const ActiveShell&) = delete;
+
+        ~ActiveShell()
+        {
+                swap();
+
+                std::error_code ec;
+                state.cwd = fs::current_path(ec);
+                state.mask = umask(host_mask);
+                fs::current_path(host_cwd, ec);
+
+                running = true;
+                function_returning = false;
+        }
+
+private:
+        void swap()
+        {
+                std::swap(state.vars, shell_vars);
+                std::swap(state.params, positional_params);
+                std::swap(state.options, shell_options);
+                std::swap(state.old_path, old_path);
+                std::swap(state.old_path_set, old_path_set);
+                std::swap(state.last_status, last_status);
+                ShellFunctions::swap(state.functions);
+                Aliases::swap(state.aliases);
+        }
+
+        shellter::Shell::State& state;
+        fs::path host_cwd;
+        mode_t host_mask;
+};
+
+shellter::Shell::Shell()
+    : state(std::make_unique<State>())
+{
+        const std::lock_guard lock(embedded_mutex);
+
+        if(!embedded)
+        {
+                embedded = true;
+                set_user_and_host();
+        }
+
+        /* starts in the directory and with the umask of the process */
+        state->mask = umask(0);
+        umask(state->mask);
+
+        const ActiveShell active(*state);
+        import_environment();
+}
+
+shellter::Shell::~Shell() = default;
+shellter::Shell::Shell(Shell&&) noexcept = default;
+shellter::Shell& shellter::Shell::operator=(Shell&&) noexcept = default;
+
+/* sends 'fd' to an anonymous file and returns the file */
+static int capture_fd(const int fd)
+{
+        const int file = memfd_create("shellter-output", MFD_CLOEXEC);
+        if(file >= 0)
+        {
+                dup2(file, fd);
+        }
+
+        return file;
+}
+
+static void read_captured(const int file, std::string& out)
+{
+        out.clear();
+
+        struct stat st;
+        if(file < 0 || fstat(file, &st) < 0)
+        {
+                return;
+        }
+
+        out.resize(static_cast<std::size_t>(st.st_size));
+        std::size_t done = 0;
+        while(done < out.size())
+        {
+                const ssize_t n = pread(file, out.data() + done, out.size() - done, static_cast<off_t>(done));
+                if(n < 0 && errno == EINTR)
+                {
+                        continue;
+                }
+                if(n <= 0)
+                {
+                        break;
+                }
+
+                done += static_cast<std::size_t>(n);
+        }
+        out.resize(done);
+}
+
+int shellter::Shell::run(const std::string_view script, std::string* out, std::string* err)
+{
+        const std::lock_guard lock(embedded_mutex);
+
+        /* whatever the script redirects, even with 'exec', the process gets its
+         * fds back */
+        SavedFds host_fds{};
+        for(int fd = 0; fd <= REDIR_FD_LIMIT; ++fd)
+        {
+                host_fds.save(fd);
+        }
+
+        const int out_file = (out != nullptr) ? capture_fd(STDOUT_FILENO) : -1;
+        int err_file = -1;
+        if(err != nullptr && err == out)
+        {
+                dup2(STDOUT_FILENO, STDERR_FILENO);
+        }
+        else if(err != nullptr)
+        {
+                err_file = capture_fd(STDERR_FILENO);
+        }
+
+        int status;
+        {
+                const ActiveShell active(*state);
+                status = run_source(script);
+        }
+
+        for(const auto& [file, str] : {std::pair(out_file, out), std::pair(err_file, err)})
+        {
+                if(file >= 0)
+                {
+                        read_captured(file, *str);
+                        close(file);
+                }
+        }
+
+        return status;
+}
@@ -0,0 +1,224 @@
+/* the Executor of libshellter (see shellter.h)
+ *
+ * a command is forked off, with the state of the executor's shell, by the
+ * thread that submits it; the child runs it like 'shellter -c' would and its
+ * stdout and stderr go to anonymous files. The reaper thread sleeps in epoll on
+ * a pidfd per child and on an eventfd that's written when there's something
+ * else to do (a result that didn't come from a pidfd, the executor going away) */
+struct shellter::Executor::Impl
+{
+        struct Job
+        {
+                pid_t pid;
+                int out_file;
+                int err_file;
+                std::function<void(Result)> done;
+        };
+
+        shellter::Shell shell;
+
+        std::mutex jobs_mutex;
+        std::unordered_map<int, Job> jobs; /* by pidfd */
+        std::vector<std::pair<Result, std::function<void(Result)>>> ready; /* waiting to be delivered */
+        bool stopping = false;
+
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::thread reaper;
+
+        void wake() const
+        {
+                const std::uint64_t one = 1;
+                write(wake_fd, &one, sizeof(one));
+        }
+
+        void reap(const int pidfd)
+        {
+                Job job;
+                {
+                        const std::lock_guard lock(jobs_mutex);
+                        const auto it = jobs.find(pidfd);
+                        if(it == jobs.end())
+                        {
+                                return;
+                        }
+
+                        job = std::move(it->second);
+                        jobs.erase(it);
+                }
+
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfd, nullptr);
+                close(pidfd);
+
+                Result result;
+                int status = 0;
+                while(wait4(job.pid, &status, 0, &result.usage) < 0 && errno == EINTR)
+                {
+                }
+                result.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+                read_captured(job.out_file, result.out);
+                read_captured(job.err_file, result.err);
+                close(job.out_file);
+                close(job.err_file);
+
+                job.done(std::move(result));
+        }
+
+        void run_reaper()
+        {
+                std::array<epoll_event, 64> events;
+                while(true)
+                {
+                        const int n = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), -1);
+                        for(int i = 0; i < n; ++i)
+                        {
+                                if(events[i].data.fd == wake_fd)
+                                {
+                                        std::uint64_t count;
+                                        read(wake_fd, &count, sizeof(count));
+                                }
+                                else
+                                {
+                                        reap(events[i].data.fd);
+                                }
+                        }
+
+                        std::vector<std::pair<Result, std::function<void(Result)>>> to_deliver;
+                        {
+                                const std::lock_guard lock(jobs_mutex);
+                                std::swap(to_deliver, ready);
+                        }
+
+                        for(auto& [result, callback] : to_deliver)
+                        {
+                                callback(std::move(result));
+                        }
+
+                        /* checked after delivering: one wakeup may stand for both a
+                         * result queued by submit() and the destructor */
+                        const std::lock_guard lock(jobs_mutex);
+                        if(stopping && jobs.empty() && ready.empty())
+                        {
+                                return;
+                        }
+                }
+        }
+};
+
+shellter::Executor::Executor()
+    : impl(std::make_unique<Impl>())
+{
+        impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        impl->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = impl->wake_fd;
+        epoll_ctl(impl->epoll_fd, EPOLL_CTL_ADD, impl->wake_fd, &event);
+
+        impl->reaper = std::thread([this] { impl->run_reaper(); });
+}
+
+shellter::Executor::~Executor()
+{
+        {
+                const std::lock_guard lock(impl->jobs_mutex);
+                impl->stopping = true;
+        }
+        impl->wake();
+        impl->reaper.join();
+
+        close(impl->epoll_fd);
+        close(impl->wake_fd);
+}
+
+shellter::Shell& shellter::Executor::shell()
+{
+        return impl->shell;
+}
+
+std::future<shellter::Result> shellter::Executor::submit(const std::string_view script)
+{
+        /* std::function wants something it can copy */
+        auto promise = std::make_shared<std::promise<Result>>();
+        auto future = promise->get_future();
+        submit(script, [promise](Result result) { promise->set_value(std::move(result)); });
+
+        return future;
+}
+
+void shellter::Executor::submit(const std::string_view script, std::function<void(Result)> done)
+{
+        const int out_file = memfd_create("shellter-output", MFD_CLOEXEC);
+        const int err_file = memfd_create("shellter-output", MFD_CLOEXEC);
+
+        pid_t pid = -1;
+        if(out_file >= 0 && err_file >= 0)
+        {
+                /* forked while no shell runs, so that the globals are whole */
+                const std::lock_guard lock(embedded_mutex);
+                pid = fork();
+        }
+
+        if(pid == 0)
+        {
+                /* the only thread of the child: nothing else will ever take a lock */
+                const int null_fd = open("/dev/null", O_RDONLY);
+                dup2(null_fd, STDIN_FILENO);
+                dup2(out_file, STDOUT_FILENO);
+                dup2(err_file, STDERR_FILENO);
+
+                int status;
+                {
+                        const ActiveShell active(*impl->shell.state);
+                        status = run_source(script);
+                }
+                exit_child(status);
+        }
+
+        const int pidfd = (pid > 0) ? static_cast<int>(syscall(SYS_pidfd_open, pid, 0)) : -1;
+        if(pidfd < 0)
+        {
+                Result result;
+                if(pid > 0)
+                {
+                        /* a kernel without pidfds: the command is waited for here */
+                        int status = 0;
+                        while(wait4(pid, &status, 0, &result.usage) < 0 && errno == EINTR)
+                        {
+                        }
+                        result.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+                        read_captured(out_file, result.out);
+                        read_captured(err_file, result.err);
+                }
+                else
+                {
+                        result.status = 126;
+                        result.err = fmt::format("shellter: cannot run command: {}\n", strerror(errno));
+                }
+
+                for(const int file : {out_file, err_file})
+                {
+                        if(file >= 0)
+                        {
+                                close(file);
+                        }
+                }
+
+                {
+                        const std::lock_guard lock(impl->jobs_mutex);
+                        impl->ready.emplace_back(std::move(result), std::move(done));
+                }
+                impl->wake();
+                return;
+        }
+
+        const std::lock_guard lock(impl->jobs_mutex);
+        impl->jobs.emplace(pidfd, Impl::Job{pid, out_file, err_file, std::move(done)});
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = pidfd;
+        epoll_ctl(impl->epoll_fd, EPOLL_CTL_ADD, pidfd, &event);
+}
@@ -0,0 +1,1062 @@
+/* word expansion
+ *
+ * a single left-to-right pass over each word: quotes are removed, the text
+ * between special characters is copied as is and every reference is replaced
+ * by the value of the variable; names are looked up as views into the word,
+ * without building strings */
+class WordExpander
+{
+public:
+        /* appends the fields 'word' expands to; returns false on a bad substitution */
+        static bool expand(const std::string_view word, std::vector<std::string>& out)
+        {
+                return expand(word, out, {});
+        }
+
+        /* the whole expansion of a command word: braces, then expand_paths() on
+         * each of the words they produce */
+        static bool expand_words(const std::string_view word, std::vector<std::string>& out)
+        {
+                if(word.find('{') == word.npos)
+                {
+                        return expand_paths(word, out);
+                }
+
+                const BraceExpansion braces(word);
+
+                std::string generated;
+                for(std::uint64_t i = 0; i < braces.size(); ++i)
+                {
+                        braces.word_at(i, generated);
+                        if(!expand_paths(generated, out))
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        /* expand(), then pathname expansion: each field with unquoted wildcards
+         * is replaced by the paths it matches, if any */
+        static bool expand_paths(const std::string_view word, std::vector<std::string>& out)
+        {
+                /* only wildcards in the word or in the values of its references */
+                if(word.find_first_of("*?[$") == word.npos)
+                {
+                        return expand(word, out);
+                }
+
+                std::vector<std::string> patterns;
+                if(!expand(word, patterns, GLOB_SPECIAL))
+                {
+                        return false;
+                }
+
+                for(const auto& pattern : patterns)
+                {
+                        if(!PathGlob::has_wildcards(pattern) || !PathGlob::expand(pattern, out))
+                        {
+                                out.push_back(PathGlob::unescape(pattern));
+                        }
+                }
+
+                return true;
+        }
+
+        /* expands 'word' into a single string, joining its fields with spaces */
+        static bool expand_joined(const std::string_view word, std::string& out)
+        {
+                return join(word, out, {});
+        }
+
+        /* like expand_joined(), for a pattern: the quoted characters are
+         * escaped, so they only match themselves */
+        static bool expand_pattern(const std::string_view word, std::string& out)
+        {
+                return join(word, out, GLOB_SPECIAL);
+        }
+
+        /* the same, for an extended regular expression */
+        static bool expand_regex(const std::string_view word, std::string& out)
+        {
+                return join(word, out, REGEX_SPECIAL);
+        }
+
+private:
+        /* the characters escaped in quoted text, for each kind of pattern */
+        static constexpr std::string_view GLOB_SPECIAL = "*?[]\\";
+        static constexpr std::string_view REGEX_SPECIAL = "\\^$.|?*+()[]{}";
+
+        static bool join(const std::string_view word, std::string& out, const std::string_view escaped)
+        {
+                std::vector<std::string> fields;
+                if(!expand(word, fields, escaped))
+                {
+                        return false;
+                }
+
+                for(std::size_t i = 0; i < fields.size(); ++i)
+                {
+                        if(i > 0)
+                        {
+                                out.push_back(' ');
+                        }
+                        out.append(fields[i]);
+                }
+
+                return true;
+        }
+
+        static bool expand(const std::string_view word, std::vector<std::string>& out,
+                           const std::string_view escaped)
+        {
+                static constexpr std::string_view special = "$\\'\"";
+
+                std::size_t pos = word.find_first_of(special);
+                if(pos == word.npos)
+                {
+                        out.emplace_back(word);
+                        return true;
+                }
+
+                Fields fields{out};
+                fields.escaped = escaped;
+                fields.append_literal(word.substr(0, pos));
+
+                bool in_double = false;
+                while(pos < word.size())
+                {
+                        const char c = word[pos];
+                        if(c == '\\')
+                        {
+                                /* inside double quotes, a backslash only escapes the
+                                 * characters that are special there */
+                                const bool escapes = pos + 1 < word.size() &&
+                                                     (!in_double || std::string_view("$`\"\\\n").find(word[pos + 1]) != word.npos);
+                                if(escapes)
+                                {
+                                        ++pos;
+                                }
+
+                                fields.append_literal(word.substr(pos, 1), escapes || in_double);
+                                ++pos;
+                        }
+                        else if(c == '\'' && !in_double)
+                        {
+                                const auto close = std::min(word.find('\'', pos + 1), word.size());
+                                fields.append_literal(word.substr(pos + 1, close - pos - 1), true);
+                                fields.literal = true;
+                                pos = close + 1;
+                        }
+                        else if(c == '"')
+                        {
+                                in_double = !in_double;
+                                fields.literal = true;
+                                ++pos;
+                        }
+                        else if(c == '$')
+                        {
+                                fields.quoted = in_double;
+                                const auto consumed = expand_reference(word.substr(pos), fields);
+                                if(consumed == 0)
+                                {
+                                        print_err_fmt("shellter: bad substitution: '{}'\n", word);
+                                        return false;
+                                }
+
+                                if(consumed == FAILED)
+                                {
+                                        return false;
+                                }
+
+                                pos += consumed;
+                        }
+                        else
+                        {
+                                const auto next = std::min(word.find_first_of(special, pos + 1), word.size());
+                                fields.append_literal(word.substr(pos, next - pos), in_double);
+                                pos = next;
+                        }
+                }
+
+                fields.finish();
+
+                return true;
+        }
+
+        /* returned by expand_reference() for errors it already reported */
+        static constexpr std::size_t FAILED = std::string_view::npos;
+
+        /* the fields produced by one word; an array expanded with [@] ends the
+         * current field at each element */
+        struct Fields
+        {
+                std::vector<std::string>& out;
+                std::string current = {};
+                bool literal = false; /* words made only of empty expansions vanish */
+                std::string_view escaped = {}; /* characters escaped in quoted text */
+                bool quoted = false;  /* the expansion being appended is quoted */
+
+                void append_literal(const std::string_view sv, const bool quoted_text = false)
+                {
+                        append(sv, quoted_text);
+                        literal = literal || !sv.empty();
+                }
+
+                void append_value(const std::string_view sv)
+                {
+                        append(sv, quoted);
+                }
+
+                void append(const std::string_view sv, const bool quoted_text)
+                {
+                        if(escaped.empty() || !quoted_text)
+                        {
+                                current.append(sv);
+                                return;
+                        }
+
+                        for(const char c : sv)
+                        {
+                                if(escaped.find(c) != escaped.npos)
+                                {
+                                        current.push_back('\\');
+                                }
+                                current.push_back(c);
+                        }
+                }
+
+                void split()
+                {
+                        out.push_back(std::move(current));
+                        current.clear();
+                        literal = true;
+                }
+
+                void finish()
+                {
+                        if(!current.empty() || literal)
+                        {
+                                out.push_back(std::move(current));
+                        }
+                }
+        };
+
+        static const char* find_dollar(const std::string_view word, const std::size_t pos)
+        {
+                return static_cast<const char*>(
+                    std::memchr(word.data() + pos, '$', word.size() - pos));
+        }
+
+        /* position of the '))' closing the '$((' 'ref' starts with */
+        static std::size_t find_arith_end(const std::string_view ref)
+        {
+                std::size_t depth = 0;
+                for(std::size_t i = 3; i < ref.size(); ++i)
+                {
+                        if(ref[i] == '(')
+                        {
+                                ++depth;
+                        }
+                        else if(ref[i] == ')')
+                        {
+                                if(depth == 0)
+                                {
+                                        return (ref.compare(i, 2, "))") == 0) ? i : ref.npos;
+                                }
+                                --depth;
+                        }
+                }
+
+                return ref.npos;
+        }
+
+        /* a number, '@' or '*' */
+        static bool is_positional(const std::string_view name)
+        {
+                return name == "@" || name == "*" ||
+                       (!name.empty() && name.find_first_not_of("0123456789") == name.npos);
+        }
+
+        static std::size_t name_length(const std::string_view sv)
+        {
+                if(sv.empty() || !(std::isalpha(static_cast<unsigned char>(sv[0])) || sv[0] == '_'))
+                {
+                        return 0;
+                }
+
+                std::size_t len = 1;
+                while(len < sv.size() &&
+                      (std::isalnum(static_cast<unsigned char>(sv[len])) || sv[len] == '_'))
+                {
+                        ++len;
+                }
+
+                return len;
+        }
+
+        /* expands the reference 'ref' starts with and returns its length
+         * (0 for a malformed reference) */
+        static std::size_t expand_reference(const std::string_view ref, Fields& fields)
+        {
+                /* $(( EXPRESSION )) */
+                if(ref.starts_with("$(("))
+                {
+                        const auto close_pos = find_arith_end(ref);
+                        if(close_pos == ref.npos)
+                        {
+                                return 0;
+                        }
+
+                        const auto value = evaluate_operand(ref.substr(3, close_pos - 3));
+                        if(!value.has_value())
+                        {
+                                return FAILED;
+                        }
+
+                        fields.append_value(fmt::format_int(*value).str());
+                        return close_pos + 2;
+                }
+
+                /* $?, the status of the last command */
+                if(ref.size() > 1 && ref[1] == '?')
+                {
+                        fields.append_value(fmt::format_int(last_status).str());
+                        return 2;
+                }
+
+                /* $#, the number of positional parameters */
+                if(ref.size() > 1 && ref[1] == '#')
+                {
+                        fields.append_value(fmt::format_int(positional_params.size() - 1).str());
+                        return 2;
+                }
+
+                /* $0 ... $9, $@ and $* */
+                if(ref.size() > 1 && is_positional(ref.substr(1, 1)))
+                {
+                        Parameter param;
+                        param.name = ref.substr(1, 1);
+                        param.all = !std::isdigit(static_cast<unsigned char>(ref[1]));
+
+                        std::vector<std::string_view> values;
+                        lookup(param, std::nullopt, values);
+                        for(std::size_t i = 0; i < values.size(); ++i)
+                        {
+                                if(i > 0)
+                                {
+                                        fields.split();
+                                }
+                                fields.append_value(values[i]);
+                        }
+
+                        return 2;
+                }
+
+                /* $NAME */
+                if(ref.size() < 2 || ref[1] != '{')
+                {
+                        const auto len = name_length(ref.substr(1));
+                        if(len == 0)
+                        {
+                                /* a lone '$' stands for itself */
+                                fields.append_literal("$");
+                                return 1;
+                        }
+
+                        append_scalar(ref.substr(1, len), fields);
+                        return len + 1;
+                }
+
+                /* ${...} */
+                const auto close_pos = find_brace_end(ref);
+                if(close_pos == ref.npos)
+                {
+                        return 0;
+                }
+
+                if(!expand_braced(ref.substr(0, close_pos + 1), fields))
+                {
+                        return FAILED;
+                }
+
+                return close_pos + 1;
+        }
+
+        /* position of the '}' closing the '${' 'ref' starts with */
+        static std::size_t find_brace_end(const std::string_view ref)
+        {
+                std::size_t depth = 0;
+                for(std::size_t i = 2; i < ref.size(); ++i)
+                {
+                        if(ref[i] == '\\')
+                        {
+                                ++i;
+                        }
+                        else if(ref[i] == '{')
+                        {
+                                ++depth;
+                        }
+                        else if(ref[i] == '}')
+                        {
+                                if(depth == 0)
+                                {
+                                        return i;
+                                }
+                                --depth;
+                        }
+                }
+
+                return ref.npos;
+        }
+
+        /* the text of ${...} after the parameter name */
+        enum class Operator
+        {
+                NONE,
+                DEFAULT,      /* :- and - */
+                ASSIGN,       /* := and = */
+                ALTERNATIVE,  /* :+ and + */
+                ERROR,        /* :? and ? */
+                PREFIX,       /* # and ## */
+                SUFFIX,       /* % and %% */
+                REPLACE,      /* /, //, /# and /% */
+                SUBSTRING     /* :OFFSET and :OFFSET:LENGTH */
+        };
+
+        struct Parameter
+        {
+                std::string_view name;
+                std::string_view subscript; /* empty for plain names */
+                bool all = false;           /* [@] or [*] */
+                bool length = false;        /* ${#...} */
+                Operator op = Operator::NONE;
+                bool colon = false;         /* :-, :=, :+ and :? also apply to empty values */
+                bool longest = false;       /* ##, %% and // */
+                char anchor = '\0';         /* '#' or '%' for /# and /% */
+                std::string_view operand;
+        };
+
+        static bool parse_parameter(std::string_view body, Parameter& param)
+        {
+                param.length = body.size() > 1 && body.front() == '#';
+                if(param.length)
+                {
+                        body.remove_prefix(1);
+                }
+
+                /* ${10}, ${@:2} */
+                auto len = name_length(body);
+                if(len == 0 && !body.empty())
+                {
+                        len = (body.front() == '@' || body.front() == '*')
+                                  ? 1
+                                  : std::min(body.find_first_not_of("0123456789"), body.size());
+                        param.all = (len == 1 && !std::isdigit(static_cast<unsigned char>(body.front())));
+                }
+
+                if(len == 0)
+                {
+                        return false;
+                }
+
+                param.name = body.substr(0, len);
+                body.remove_prefix(len);
+
+                if(!body.empty() && body.front() == '[' && !is_positional(param.name))
+                {
+                        const auto close = body.find(']');
+                        if(close == body.npos || close == 1)
+                        {
+                                return false;
+                        }
+
+                        param.subscript = body.substr(1, close - 1);
+                        param.all = (param.subscript == "@" || param.subscript == "*");
+                        body.remove_prefix(close + 1);
+                }
+
+                if(body.empty())
+                {
+                        return true;
+                }
+
+                if(param.length)
+                {
+                        return false;
+                }
+
+                const char c = body.front();
+                param.colon = (c == ':');
+                if(param.colon)
+                {
+                        body.remove_prefix(1);
+                        if(body.empty() || std::string_view("-=+?").find(body.front()) == body.npos)
+                        {
+                                param.op = Operator::SUBSTRING;
+                                param.operand = body;
+                                return !body.empty();
+                        }
+                }
+
+                switch(body.front())
+                {
+                case '-':
+                        param.op = Operator::DEFAULT;
+                        break;
+                case '=':
+                        param.op = Operator::ASSIGN;
+                        break;
+                case '+':
+                        param.op = Operator::ALTERNATIVE;
+                        break;
+                case '?':
+                        param.op = Operator::ERROR;
+                        break;
+                case '#':
+                        param.op = Operator::PREFIX;
+                        break;
+                case '%':
+                        param.op = Operator::SUFFIX;
+                        break;
+                case '/':
+                        param.op = Operator::REPLACE;
+                        break;
+                default:
+                        return false;
+                }
+
+                body.remove_prefix(1);
+                if(param.op == Operator::PREFIX || param.op == Operator::SUFFIX ||
+                   param.op == Operator::REPLACE)
+                {
+                        const char repeat = (param.op == Operator::REPLACE) ? '/' : c;
+                        if(!body.empty() && body.front() == repeat)
+                        {
+                                param.longest = true;
+                                body.remove_prefix(1);
+                        }
+                        else if(param.op == Operator::REPLACE && !body.empty() &&
+                                (body.front() == '#' || body.front() == '%'))
+                        {
+                                param.anchor = body.front();
+                                body.remove_prefix(1);
+                        }
+                }
+
+                param.operand = body;
+                return true;
+        }
+
+        /* expands one ${...} reference; 'ref' is the whole reference */
+        static bool expand_braced(const std::string_view ref, Fields& fields)
+        {
+                Parameter param;
+                if(!parse_parameter(ref.substr(2, ref.size() - 3), param))
+                {
+                        print_err_fmt("shellter: bad substitution: '{}'\n", ref);
+                        return false;
+                }
+
+                /* operands are expanded before the variable is looked up, since
+                 * expanding them may change it */
+                std::string operand;
+                std::string replacement;
+                if(param.op == Operator::REPLACE)
+                {
+                        const auto slash = find_unescaped(param.operand, '/');
+                        if(slash != param.operand.npos &&
+                           !expand_joined(param.operand.substr(slash + 1), replacement))
+                        {
+                                return false;
+                        }
+
+                        param.operand = param.operand.substr(0, std::min(slash, param.operand.size()));
+                }
+
+                const bool transform = (param.op == Operator::PREFIX || param.op == Operator::SUFFIX ||
+                                        param.op == Operator::REPLACE);
+                if(param.op != Operator::NONE && param.op != Operator::SUBSTRING &&
+                   !join(param.operand, operand, transform ? GLOB_SPECIAL : std::string_view()))
+                {
+                        return false;
+                }
+
+                std::optional<std::int64_t> index;
+                if(!param.subscript.empty() && !param.all)
+                {
+                        index = evaluate_operand(param.subscript);
+                        if(!index.has_value())
+                        {
+                                return false;
+                        }
+                }
+
+                std::optional<std::int64_t> offset;
+                std::optional<std::int64_t> count;
+                if(param.op == Operator::SUBSTRING)
+                {
+                        const auto colon = find_unescaped(param.operand, ':');
+                        offset = evaluate_operand(param.operand.substr(0, colon));
+                        if(!offset.has_value())
+                        {
+                                return false;
+                        }
+
+                        if(colon != param.operand.npos)
+                        {
+                                count = evaluate_operand(param.operand.substr(colon + 1));
+                                if(!count.has_value())
+                                {
+                                        return false;
+                                }
+                        }
+                }
+
+                /* the values the parameter stands for, as views into the store */
+                std::vector<std::string_view> values;
+                const bool set = lookup(param, index, values);
+
+                if(param.length)
+                {
+                        const std::size_t len = param.all ? values.size()
+                                                          : (set ? values.front().size() : 0);
+                        fields.append_value(fmt::format_int(len).str());
+                        return true;
+                }
+
+                const bool empty = !set || (values.size() == 1 && values.front().empty());
+                const bool missing = param.colon ? empty : !set;
+
+                switch(param.op)
+                {
+                case Operator::DEFAULT:
+                        if(missing)
+                        {
+                                fields.append_value(operand);
+                                return true;
+                        }
+                        break;
+                case Operator::ASSIGN:
+                        if(missing)
+                        {
+                                if(!param.subscript.empty() || is_positional(param.name))
+                                {
+                                        print_err_fmt("shellter: {}: cannot assign in this way\n", ref);
+                                        return false;
+                                }
+
+                                shell_vars.set(param.name, operand);
+                                fields.append_value(operand);
+                                return true;
+                        }
+                        break;
+                case Operator::ALTERNATIVE:
+                        if(!missing)
+                        {
+                                fields.append_value(operand);
+                        }
+                        return true;
+                case Operator::ERROR:
+                        if(missing)
+                        {
+                                print_err_fmt("shellter: {}: {}\n", param.name,
+                                              operand.empty() ? "parameter null or not set"
+                                                              : std::string_view(operand));
+                                return false;
+                        }
+                        break;
+                case Operator::SUBSTRING:
+                        /* positional parameters count from $0 */
+                        if(param.all && is_positional(param.name))
+                        {
+                                if(*offset == 0)
+                                {
+                                        values.insert(values.begin(), positional_params[0]);
+                                }
+                                else if(*offset > 0)
+                                {
+                                        --*offset;
+                                }
+                        }
+
+                        if(param.all)
+                        {
+                                slice(values, *offset, count);
+                        }
+                        else if(set)
+                        {
+                                values.front() = substring(values.front(), *offset, count);
+                        }
+                        break;
+                default:
+                        break;
+                }
+
+                if(!set)
+                {
+                        return true;
+                }
+
+                const std::optional<GlobPattern> pattern =
+                    transform ? std::optional<GlobPattern>(std::in_place, operand) : std::nullopt;
+
+                std::string replaced;
+                for(std::size_t i = 0; i < values.size(); ++i)
+                {
+                        if(i > 0)
+                        {
+                                fields.split();
+                        }
+
+                        switch(param.op)
+                        {
+                        case Operator::PREFIX:
+                                fields.append_value(remove_prefix(values[i], *pattern, param.longest));
+                                break;
+                        case Operator::SUFFIX:
+                                fields.append_value(remove_suffix(values[i], *pattern, param.longest));
+                                break;
+                        case Operator::REPLACE:
+                                replace(values[i], *pattern, replacement, param, replaced);
+                                fields.append_value(replaced);
+                                break;
+                        default:
+                                fields.append_value(values[i]);
+                                break;
+                        }
+                }
+
+                return true;
+        }
+
+        /* fills 'values' with the value(s) of the parameter; returns false if
+         * it's unset */
+        static bool lookup(const Parameter& param, const std::optional<std::int64_t> index,
+                           std::vector<std::string_view>& values)
+        {
+                if(is_positional(param.name))
+                {
+                        return lookup_positional(param.name, values);
+                }
+
+                const auto* var = shell_vars.find(param.name);
+                if(var == nullptr)
+                {
+                        return false;
+                }
+
+                if(var->array == nullptr)
+                {
+                        /* a scalar is an array of one element */
+                        if(index.has_value() && *index != 0 && *index != -1)
+                        {
+                                return false;
+                        }
+
+                        values.push_back(var->value);
+                        return true;
+                }
+
+                const ShellArray& arr = *var->array;
+                const auto len = static_cast<std::int64_t>(arr.size());
+
+                if(param.all)
+                {
+                        values.reserve(arr.size());
+                        for(std::size_t i = 0; i < arr.size(); ++i)
+                        {
+                                values.push_back(arr[i]);
+                        }
+
+                        return !values.empty();
+                }
+
+                /* a plain reference to an array is its first element; negative
+                 * indexes count from the end */
+                std::int64_t i = index.value_or(0);
+                if(i < 0)
+                {
+                        i += len;
+                }
+
+                if(i < 0 || i >= len)
+                {
+                        return false;
+                }
+
+                values.push_back(arr[static_cast<std::size_t>(i)]);
+                return true;
+        }
+
+        static bool lookup_positional(const std::string_view name, std::vector<std::string_view>& values)
+        {
+                if(name == "@" || name == "*")
+                {
+                        values.assign(positional_params.begin() + 1, positional_params.end());
+                        return !values.empty();
+                }
+
+                std::size_t n = 0;
+                std::from_chars(name.data(), name.data() + name.size(), n);
+                if(n >= positional_params.size())
+                {
+                        return false;
+                }
+
+                values.push_back(positional_params[n]);
+                return true;
+        }
+
+        static std::optional<std::int64_t> evaluate_operand(const std::string_view text)
+        {
+                if(find_dollar(text, 0) == nullptr)
+                {
+                        return Arithmetic::evaluate(text);
+                }
+
+                std::optional<std::int64_t> value;
+                if(Arithmetic::evaluate_refs(text, value))
+                {
+                        return value;
+                }
+
+                std::string expanded;
+                if(!expand_joined(text, expanded))
+                {
+                        return std::nullopt;
+                }
+
+                return Arithmetic::evaluate(expanded);
+        }
+
+        /* position of the first 'c' not escaped and not inside a nested
+         * expansion */
+        static std::size_t find_unescaped(const std::string_view sv, const char c)
+        {
+                std::size_t depth = 0;
+                for(std::size_t i = 0; i < sv.size(); ++i)
+                {
+                        if(sv[i] == '\\')
+                        {
+                                ++i;
+                        }
+                        else if(sv[i] == '{' || sv[i] == '(')
+                        {
+                                ++depth;
+                        }
+                        else if((sv[i] == '}' || sv[i] == ')') && depth > 0)
+                        {
+                                --depth;
+                        }
+                        else if(sv[i] == c && depth == 0)
+                        {
+                                return i;
+                        }
+                }
+
+                return sv.npos;
+        }
+
+        /* resolves a possibly negative offset and length against 'size' */
+        static std::pair<std::size_t, std::size_t> clamp_range(const std::size_t size,
+                                                               std::int64_t offset,
+                                                               const std::optional<std::int64_t> count)
+        {
+                const auto ssize = static_cast<std::int64_t>(size);
+                if(offset < 0)
+                {
+                        offset = std::max<std::int64_t>(offset + ssize, 0);
+                }
+                offset = std::min(offset, ssize);
+
+                /* a negative length counts back from the end */
+                std::int64_t end = ssize;
+                if(count.has_value())
+                {
+                        end = (*count < 0) ? ssize + *count : offset + std::min(*count, ssize - offset);
+                }
+
+                end = std::max(end, offset);
+                return {static_cast<std::size_t>(offset), static_cast<std::size_t>(end - offset)};
+        }
+
+        static std::string_view substring(const std::string_view value, const std::int64_t offset,
+                                          const std::optional<std::int64_t> count)
+        {
+                const auto [begin, len] = clamp_range(value.size(), offset, count);
+                return value.substr(begin, len);
+        }
+
+        static void slice(std::vector<std::string_view>& values, const std::int64_t offset,
+                          const std::optional<std::int64_t> count)
+        {
+                const auto [begin, len] = clamp_range(values.size(), offset, count);
+                values.erase(values.begin() + static_cast<std::ptrdiff_t>(begin + len), values.end());
+                values.erase(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(begin));
+        }
+
+        static std::string_view remove_prefix(const std::string_view value, const GlobPattern& pattern,
+                                              const bool longest)
+        {
+                if(pattern.is_literal())
+                {
+                        return value.starts_with(pattern.literal())
+                                   ? value.substr(pattern.literal().size())
+                                   : value;
+                }
+
+                for(std::size_t i = 0; i <= value.size(); ++i)
+                {
+                        const std::size_t len = longest ? value.size() - i : i;
+                        if(pattern.match(value.substr(0, len)))
+                        {
+                                return value.substr(len);
+                        }
+                }
+
+                return value;
+        }
+
+        static std::string_view remove_suffix(const std::string_view value, const GlobPattern& pattern,
+                                              const bool longest)
+        {
+                if(pattern.is_literal())
+                {
+                        return value.ends_with(pattern.literal())
+                                   ? value.substr(0, value.size() - pattern.literal().size())
+                                   : value;
+                }
+
+                for(std::size_t i = 0; i <= value.size(); ++i)
+                {
+                        const std::size_t begin = longest ? i : value.size() - i;
+                        if(pattern.match(value.substr(begin)))
+                        {
+                                return value.substr(0, begin);
+                        }
+                }
+
+                return value;
+        }
+
+        /* length of the longest match of 'pattern' at the start of 'sv' that
+         * ends where required; npos if there's none */
+        static std::size_t match_at(const std::string_view sv, const GlobPattern& pattern,
+                                    const bool to_end)
+        {
+                if(pattern.is_literal())
+                {
+                        const auto lit = pattern.literal();
+                        const bool matched = to_end ? sv == lit : sv.starts_with(lit);
+                        return matched ? lit.size() : sv.npos;
+                }
+
+                for(std::size_t len = sv.size() + 1; len-- > 0;)
+                {
+                        if(pattern.match(sv.substr(0, len)))
+                        {
+                                return len;
+                        }
+
+                        if(to_end)
+                        {
+                                break;
+                        }
+                }
+
+                return sv.npos;
+        }
+
+        static void replace(const std::string_view value, const GlobPattern& pattern,
+                            const std::string_view replacement, const Parameter& param,
+                            std::string& out)
+        {
+                out.clear();
+
+                if(param.anchor == '#')
+                {
+                        const auto len = match_at(value, pattern, false);
+                        if(len == value.npos)
+                        {
+                                out.append(value);
+                                return;
+                        }
+
+                        out.append(replacement);
+                        out.append(value.substr(len));
+                        return;
+                }
+
+                if(param.anchor == '%')
+                {
+                        for(std::size_t begin = 0; begin <= value.size(); ++begin)
+                        {
+                                if(match_at(value.substr(begin), pattern, true) != value.npos)
+                                {
+                                        out.append(value.substr(0, begin));
+                                        out.append(replacement);
+                                        return;
+                                }
+                        }
+
+                        out.append(value);
+                        return;
+                }
+
+                /* an empty pattern matches nothing here */
+                std::size_t pos = 0;
+                std::size_t copied = 0;
+                while(pos < value.size())
+                {
+                        if(pattern.is_literal())
+                        {
+                                pos = pattern.literal().empty() ? value.npos
+                                                                : value.find(pattern.literal(), pos);
+                                if(pos == value.npos)
+                                {
+                                        break;
+                                }
+                        }
+
+                        const auto len = match_at(value.substr(pos), pattern, false);
+                        if(len == value.npos || len == 0)
+                        {
+                                ++pos;
+                                continue;
+                        }
+
+                        out.append(value.substr(copied, pos - copied));
+                        out.append(replacement);
+                        pos += len;
+                        copied = pos;
+
+                        if(!param.longest)
+                        {
+                                break;
+                        }
+                }
+
+                out.append(value.substr(copied));
+        }
+
+        static void append_scalar(const std::string_view name, Fields& fields)
+        {
+                const auto* var = shell_vars.find(name);
+                if(var == nullptr)
+                {
+                        return;
+                }
+
+                /* a plain reference to an array is its first element */
+                if(var->array == nullptr)
+                {
+                        fields.append_value(var->value);
+                }
+                else if(var->array->size() > 0)
+                {
+                        fields.append_value((*var->array)[0]);
+                }
+        }
+};
@@ -0,0 +1,601 @@
+/* shell patterns: '*', '?', '[...]' and '\' escapes
+ *
+ * a pattern is compiled once into a sequence of tokens (literal runs, single
+ * character wildcards, character classes and stars) and then matched against
+ * any number of strings without further parsing */
+class GlobPattern
+{
+public:
+        explicit GlobPattern(const std::string_view pattern)
+        {
+                compile(pattern);
+        }
+
+        bool match(const std::string_view s) const
+        {
+                /* greedy matching, backtracking to the last star on a mismatch; every
+                 * non-star token has a fixed length, which makes this exact */
+                std::size_t ti = 0;
+                std::size_t si = 0;
+                std::size_t star_ti = NO_STAR;
+                std::size_t star_si = 0;
+
+                while(si < s.size() || ti < tokens.size())
+                {
+                        if(ti < tokens.size())
+                        {
+                                const Token& tok = tokens[ti];
+                                if(tok.type == Type::STAR)
+                                {
+                                        star_ti = ti++;
+                                        star_si = si;
+                                        continue;
+                                }
+
+                                if(match_token(tok, s, si))
+                                {
+                                        si += token_length(tok);
+                                        ++ti;
+                                        continue;
+                                }
+                        }
+
+                        if(star_ti == NO_STAR || star_si >= s.size())
+                        {
+                                return false;
+                        }
+
+                        si = ++star_si;
+                        ti = star_ti + 1;
+                }
+
+                return true;
+        }
+
+        /* true if the pattern has no special characters */
+        bool is_literal() const
+        {
+                return tokens.empty() || (tokens.size() == 1 && tokens[0].type == Type::LITERAL);
+        }
+
+        /* the text matched by a literal pattern, without escapes */
+        std::string_view literal() const
+        {
+                return literals;
+        }
+
+        /* checks for characters that make a word a pattern */
+        static bool has_wildcards(const std::string_view sv)
+        {
+                return sv.find_first_of("*?[") != sv.npos;
+        }
+
+private:
+        static constexpr std::size_t NO_STAR = static_cast<std::size_t>(-1);
+
+        enum class Type : std::uint8_t
+        {
+                LITERAL,
+                ANY,
+                STAR,
+                CLASS
+        };
+
+        struct Token
+        {
+                Type type;
+                std::uint32_t index; /* LITERAL: offset in 'literals', CLASS: index in 'classes' */
+                std::uint32_t length; /* LITERAL only */
+        };
+
+        using char_class_t = std::bitset<256>;
+
+        static std::size_t token_length(const Token& tok)
+        {
+                return (tok.type == Type::LITERAL) ? tok.length : 1;
+        }
+
+        bool match_token(const Token& tok, const std::string_view s, const std::size_t si) const
+        {
+                switch(tok.type)
+                {
+                case Type::LITERAL:
+                        return si + tok.length <= s.size() &&
+                               s.compare(si, tok.length, literals, tok.index, tok.length) == 0;
+                case Type::ANY:
+                        return si < s.size();
+                case Type::CLASS:
+                        return si < s.size() && classes[tok.index][static_cast<unsigned char>(s[si])];
+                default:
+                        return false;
+                }
+        }
+
+        void add_literal(const char c)
+        {
+                if(tokens.empty() || tokens.back().type != Type::LITERAL)
+                {
+                        tokens.push_back({Type::LITERAL, static_cast<std::uint32_t>(literals.size()), 0});
+                }
+
+                literals.push_back(c);
+                ++tokens.back().length;
+        }
+
+        void compile(const std::string_view pattern)
+        {
+                for(std::size_t i = 0; i < pattern.size(); ++i)
+                {
+                        const char c = pattern[i];
+                        if(c == '\\' && i + 1 < pattern.size())
+                        {
+                                add_literal(pattern[++i]);
+                        }
+                        else if(c == '?')
+                        {
+                                tokens.push_back({Type::ANY, 0, 0});
+                        }
+                        else if(c == '*')
+                        {
+                                /* consecutive stars are one star */
+                                if(tokens.empty() || tokens.back().type != Type::STAR)
+                                {
+                                        tokens.push_back({Type::STAR, 0, 0});
+                                }
+                        }
+                        else if(c == '[')
+                        {
+                                const auto end = compile_class(pattern, i);
+                                if(end == pattern.npos)
+                                {
+                                        /* unterminated: the bracket is an ordinary character */
+                                        add_literal(c);
+                                        continue;
+                                }
+
+                                i = end;
+                        }
+                        else
+                        {
+                                add_literal(c);
+                        }
+                }
+        }
+
+        /* compiles the class starting at 'begin' and returns the position of its
+         * closing bracket */
+        std::size_t compile_class(const std::string_view pattern, const std::size_t begin)
+        {
+                static constexpr std::array<std::pair<std::string_view, int (*)(int)>, 12> named = {{
+                    {"alnum", &isalnum},
+                    {"alpha", &isalpha},
+                    {"blank", &isblank},
+                    {"cntrl", &iscntrl},
+                    {"digit", &isdigit},
+                    {"graph", &isgraph},
+                    {"lower", &islower},
+                    {"print", &isprint},
+                    {"punct", &ispunct},
+                    {"space", &isspace},
+                    {"upper", &isupper},
+                    {"xdigit", &isxdigit},
+                }};
+
+                char_class_t set;
+                std::size_t i = begin + 1;
+
+                const bool negate = (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'));
+                if(negate)
+                {
+                        ++i;
+                }
+
+                /* a ']' right after the opening bracket is part of the set */
+                for(bool first = true; i < pattern.size(); ++i, first = false)
+                {
+                        char c = pattern[i];
+                        if(c == ']' && !first)
+                        {
+                                if(negate)
+                                {
+                                        set.flip();
+                                }
+
+                                tokens.push_back({Type::CLASS, static_cast<std::uint32_t>(classes.size()), 0});
+                                classes.push_back(set);
+
+                                return i;
+                        }
+
+                        /* [:name:] */
+                        if(c == '[' && pattern.compare(i, 2, "[:") == 0)
+                        {
+                                const auto name_end = pattern.find(":]", i + 2);
+                                if(name_end != pattern.npos)
+                                {
+                                        const auto name = pattern.substr(i + 2, name_end - i - 2);
+                                        for(const auto& [class_name, pred] : named)
+                                        {
+                                                if(class_name != name)
+                                                {
+                                                        continue;
+                                                }
+
+                                                for(int ch = 0; ch < 256; ++ch)
+                                                {
+                                                        set[static_cast<std::size_t>(ch)] =
+                                                            set[static_cast<std::size_t>(ch)] || pred(ch);
+                                                }
+                                        }
+
+                                        i = name_end + 1;
+                                        continue;
+                                }
+                        }
+
+                        if(c == '\\' && i + 1 < pattern.size())
+                        {
+                                c = pattern[++i];
+                        }
+
+                        /* ranges */
+                        if(i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+                        {
+                                const auto lo = static_cast<unsigned char>(c);
+                                const auto hi = static_cast<unsigned char>(pattern[i + 2]);
+                                for(unsigned ch = lo; ch <= hi; ++ch)
+                                {
+                                        set.set(ch);
+                                }
+
+                                i += 2;
+                                continue;
+                        }
+
+                        set.set(static_cast<unsigned char>(c));
+                }
+
+                return pattern.npos;
+        }
+
+        std::vector<Token> tokens;
+        std::string literals;
+        std::vector<char_class_t> classes;
+};
+
+/* pathname expansion
+ *
+ * a pattern is split at the slashes; literal components are appended without
+ * looking at the disk, the others are matched against the entries of each
+ * directory reached so far. Directories are read with getdents64(), whose
+ * d_type tells directories apart without a stat() per entry. '**' matches any
+ * number of directories; their tree is walked by a few threads at once */
+class PathGlob
+{
+public:
+        /* appends the paths matching 'pattern', where quoted characters are
+         * escaped, in sorted order; returns false if nothing matches */
+        static bool expand(const std::string_view pattern, std::vector<std::string>& out)
+        {
+                std::vector<Component> components;
+                std::size_t begin = 0;
+                while(begin <= pattern.size())
+                {
+                        const auto end = std::min(pattern.find('/', begin), pattern.size());
+                        components.push_back(make_component(pattern.substr(begin, end - begin)));
+                        begin = end + 1;
+                }
+
+                /* an absolute pattern starts with an empty component; with a
+                 * trailing slash, only directories match */
+                const bool absolute = components.front().text.empty();
+                const bool dirs_only = components.size() > 1 && components.back().text.empty();
+                if(dirs_only)
+                {
+                        components.pop_back();
+                }
+
+                std::vector<std::string> paths = {absolute ? "/" : ""};
+                for(std::size_t i = absolute ? 1 : 0; i < components.size() && !paths.empty(); ++i)
+                {
+                        const bool last = (i == components.size() - 1);
+                        paths = match_component(paths, components[i], last && !dirs_only);
+                }
+
+                /* '**' also yields the directory it starts from, which isn't a
+                 * path when that's the current one */
+                paths.erase(std::remove(paths.begin(), paths.end(), std::string()), paths.end());
+                if(paths.empty())
+                {
+                        return false;
+                }
+
+                std::sort(paths.begin(), paths.end());
+                for(auto& path : paths)
+                {
+                        /* directories were collected with their slash */
+                        if(!dirs_only && path.size() > 1 && path.back() == '/')
+                        {
+                                path.pop_back();
+                        }
+                        out.push_back(std::move(path));
+                }
+
+                return true;
+        }
+
+        /* true if 'pattern' has an unescaped '*', '?' or '[...]'; a lone '[',
+         * like the test command, needs no directory listing */
+        static bool has_wildcards(const std::string_view pattern)
+        {
+                for(std::size_t i = 0; i < pattern.size(); ++i)
+                {
+                        if(pattern[i] == '\\')
+                        {
+                                ++i;
+                        }
+                        else if(pattern[i] == '*' || pattern[i] == '?' ||
+                                (pattern[i] == '[' && pattern.find(']', i + 2) != pattern.npos))
+                        {
+                                return true;
+                        }
+                }
+
+                return false;
+        }
+
+        /* the text a pattern without wildcards matches */
+        static std::string unescape(const std::string_view pattern)
+        {
+                std::string res;
+                res.reserve(pattern.size());
+                for(std::size_t i = 0; i < pattern.size(); ++i)
+                {
+                        if(pattern[i] == '\\' && i + 1 < pattern.size())
+                        {
+                                ++i;
+                        }
+                        res.push_back(pattern[i]);
+                }
+
+                return res;
+        }
+
+private:
+        static constexpr std::size_t MAX_WALK_THREADS = 4;
+
+        struct Component
+        {
+                std::string text; /* unescaped for literal components */
+                bool literal = true;
+                bool recursive = false; /* '**' */
+                bool hidden = false;    /* starts with a '.', so it may match dot files */
+                std::optional<GlobPattern> pattern = std::nullopt;
+        };
+
+        static Component make_component(const std::string_view text)
+        {
+                Component comp;
+                comp.literal = !has_wildcards(text);
+                comp.recursive = (text == "**");
+                comp.hidden = text.starts_with('.');
+                if(comp.literal)
+                {
+                        comp.text = unescape(text);
+                }
+                else
+                {
+                        comp.text.assign(text);
+                        comp.pattern.emplace(text);
+                }
+
+                return comp;
+        }
+
+        /* calls 'on_entry(dir_fd, name, d_type)' for the entries of 'dir' other
+         * than '.' and '..'; 'dir_fd' is 'dir' opened, for fstatat(), and d_type
+         * may be DT_UNKNOWN on some file systems */
+        static bool read_directory(const std::string& dir, const auto& on_entry)
+        {
+                const int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(fd < 0)
+                {
+                        return false;
+                }
+
+                alignas(struct dirent64) char buf[16 * 1024];
+                while(true)
+                {
+                        const auto len = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+                        if(len <= 0)
+                        {
+                                break;
+                        }
+
+                        for(long offset = 0; offset < len;)
+                        {
+                                const auto* entry = reinterpret_cast<const struct dirent64*>(buf + offset);
+                                offset += entry->d_reclen;
+
+                                const std::string_view name = entry->d_name;
+                                if(name != "." && name != "..")
+                                {
+                                        on_entry(fd, name, entry->d_type);
+                                }
+                        }
+                }
+
+                close(fd);
+                return true;
+        }
+
+        /* resolves DT_UNKNOWN, and symlinks when 'follow' is set */
+        static bool is_directory(const int dir_fd, const std::string_view name, const unsigned char type,
+                                 const bool follow)
+        {
+                if(type != DT_UNKNOWN && (type != DT_LNK || !follow))
+                {
+                        return type == DT_DIR;
+                }
+
+                struct stat st;
+                const std::string name_str(name);
+                return fstatat(dir_fd, name_str.c_str(), &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+                       S_ISDIR(st.st_mode);
+        }
+
+        static bool exists(const std::string& path)
+        {
+                struct stat st;
+                return fstatat(AT_FDCWD, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+        }
+
+        /* 'paths' end in a slash, or are empty for the current directory; the
+         * paths returned too, except when 'last' is set */
+        static std::vector<std::string> match_component(const std::vector<std::string>& paths,
+                                                        const Component& comp, const bool last)
+        {
+                std::vector<std::string> res;
+
+                if(comp.literal)
+                {
+                        for(const auto& path : paths)
+                        {
+                                std::string next = path + comp.text;
+                                if(last ? exists(next) : true)
+                                {
+                                        res.push_back(last ? std::move(next) : next + '/');
+                                }
+                        }
+
+                        return res;
+                }
+
+                if(comp.recursive)
+                {
+                        for(const auto& path : paths)
+                        {
+                                walk_tree(path, last, res);
+                        }
+
+                        return res;
+                }
+
+                for(const auto& path : paths)
+                {
+                        read_directory(path,
+                                       [&](const int dir_fd, const std::string_view name, const unsigned char type)
+                                       {
+                                               /* wildcards don't match a leading dot */
+                                               if(name.front() == '.' && !comp.hidden)
+                                               {
+                                                       return;
+                                               }
+
+                                               if(!comp.pattern->match(name))
+                                               {
+                                                       return;
+                                               }
+
+                                               if(last)
+                                               {
+                                                       res.push_back(path + std::string(name));
+                                               }
+                                               else if(is_directory(dir_fd, name, type, true))
+                                               {
+                                                       res.push_back(path + std::string(name) + '/');
+                                               }
+                                       });
+                }
+
+                return res;
+        }
+
+        /* '**': 'root' and every directory below it, or, as the last component,
+         * every file and directory below it; dot files are skipped and symlinks
+         * aren't followed */
+        static void walk_tree(const std::string& root, const bool files, std::vector<std::string>& res)
+        {
+                std::mutex mutex;
+                std::condition_variable cv;
+                std::vector<std::string> pending = {root};
+                std::size_t busy = 0;
+
+                if(!files)
+                {
+                        res.push_back(root);
+                }
+
+                const auto work = [&]()
+                {
+                        std::vector<std::string> found;
+                        std::vector<std::string> subdirs;
+
+                        std::unique_lock lock(mutex);
+                        while(true)
+                        {
+                                cv.wait(lock, [&]() { return !pending.empty() || busy == 0; });
+                                if(pending.empty())
+                                {
+                                        break;
+                                }
+
+                                const std::string dir = std::move(pending.back());
+                                pending.pop_back();
+                                ++busy;
+                                lock.unlock();
+
+                                read_directory(dir,
+                                               [&](const int dir_fd, const std::string_view name, const unsigned char type)
+                                               {
+                                                       if(name.front() == '.')
+                                                       {
+                                                               return;
+                                                       }
+
+                                                       std::string path = dir + std::string(name);
+                                                       if(is_directory(dir_fd, name, type, false))
+                                                       {
+                                                               path.push_back('/');
+                                                               subdirs.push_back(path);
+                                                               found.push_back(std::move(path));
+                                                       }
+                                                       else if(files)
+                                                       {
+                                                               found.push_back(std::move(path));
+                                                       }
+                                               });
+
+                                lock.lock();
+                                --busy;
+                                for(auto& subdir : subdirs)
+                                {
+                                        pending.push_back(std::move(subdir));
+                                }
+                                subdirs.clear();
+                                cv.notify_all();
+                        }
+
+                        for(auto& path : found)
+                        {
+                                res.push_back(std::move(path));
+                        }
+                };
+
+                /* the calling thread walks too */
+                const std::size_t thread_count =
+                    std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, MAX_WALK_THREADS) - 1;
+                std::vector<std::thread> threads;
+                threads.reserve(thread_count);
+                for(std::size_t i = 0; i < thread_count; ++i)
+                {
+                        threads.emplace_back(work);
+                }
+
+                work();
+                for(auto& thread : threads)
+                {
+                        thread.join();
+                }
+        }
+};
@@ -0,0 +1,326 @@
+/* line input from file descriptors, used by builtins such as 'read'
+ *
+ * nothing past the end of the line is taken from the fd, so the commands that
+ * read it next see the rest of the input: seekable fds are read in blocks and
+ * rewound to just after the line; pipes are peeked at with tee() through a
+ * scratch pipe and sockets with MSG_PEEK, then exactly the line is consumed;
+ * anything else (terminals, character devices) is read a byte at a time */
+class InputBuffers
+{
+public:
+        enum class LineStatus
+        {
+                COMPLETE,
+                UNTERMINATED, /* end of input reached; an empty line means nothing was read */
+                ERROR
+        };
+
+        /* must be called whenever the shell rebinds one of the redirectable fds */
+        static void fds_changed()
+        {
+                ++epoch;
+        }
+
+        /* reads one line, without its newline */
+        static LineStatus read_line(const int fd, std::string& line)
+        {
+                line.clear();
+
+                const FdState state = lookup(fd);
+                if(state.epoch == 0)
+                {
+                        return LineStatus::ERROR;
+                }
+
+                switch(state.kind)
+                {
+                case FdKind::SEEKABLE:
+                        return read_seekable(fd, line);
+                case FdKind::PIPE:
+                        return read_pipe(fd, line);
+                case FdKind::SOCKET:
+                        return read_socket(fd, line);
+                default:
+                        return read_bytes(fd, line);
+                }
+        }
+
+private:
+        static constexpr std::size_t MIN_BLOCK = 256;
+        static constexpr std::size_t MAX_BLOCK = 64 * 1024;
+
+        enum class FdKind
+        {
+                SEEKABLE,
+                PIPE,
+                SOCKET,
+                OTHER
+        };
+
+        struct FdState
+        {
+                std::uint64_t epoch = 0; /* 0 marks an unusable fd */
+                FdKind kind = FdKind::OTHER;
+        };
+
+        static FdState lookup(const int fd)
+        {
+                const bool cacheable = fd >= 0 && fd <= REDIR_FD_LIMIT;
+                if(cacheable && fd_states[fd].epoch == epoch)
+                {
+                        return fd_states[fd];
+                }
+
+                struct stat st;
+                if(fstat(fd, &st) < 0)
+                {
+                        return {};
+                }
+
+                FdState state{epoch, FdKind::OTHER};
+                if(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))
+                {
+                        state.kind = FdKind::SEEKABLE;
+                }
+                else if(S_ISFIFO(st.st_mode))
+                {
+                        state.kind = FdKind::PIPE;
+                }
+                else if(S_ISSOCK(st.st_mode))
+                {
+                        state.kind = FdKind::SOCKET;
+                }
+
+                if(cacheable)
+                {
+                        fd_states[fd] = state;
+                }
+
+                return state;
+        }
+
+        static LineStatus read_seekable(const int fd, std::string& line)
+        {
+                /* start small, so that short lines don't read (and rewind) a whole
+                 * block each; grow while no newline shows up */
+                std::array<char, MAX_BLOCK> block;
+                std::size_t block_size = MIN_BLOCK;
+
+                while(true)
+                {
+                        const ssize_t n = ::read(fd, block.data(), block_size);
+                        if(n < 0)
+                        {
+                                if(errno == EINTR)
+                                {
+                                        continue;
+                                }
+
+                                return LineStatus::ERROR;
+                        }
+
+                        if(n == 0)
+                        {
+                                return LineStatus::UNTERMINATED;
+                        }
+
+                        const auto len = static_cast<std::size_t>(n);
+                        const auto* nl = static_cast<const char*>(std::memchr(block.data(), '\n', len));
+                        if(nl != nullptr)
+                        {
+                                const auto consumed = static_cast<std::size_t>(nl - block.data()) + 1;
+                                line.append(block.data(), consumed - 1);
+
+                                if(consumed < len)
+                                {
+                                        lseek(fd, -static_cast<off_t>(len - consumed), SEEK_CUR);
+                                }
+
+                                return LineStatus::COMPLETE;
+                        }
+
+                        line.append(block.data(), len);
+                        block_size = std::min(block_size * 2, MAX_BLOCK);
+                }
+        }
+
+        /* the scratch pipe tee() copies into; a forked child makes its own, so that
+         * it never drains what its parent peeked at */
+        static const int* scratch_pipe()
+        {
+                static int fds[2] = {-1, -1};
+                static pid_t owner = -1;
+
+                if(owner != getpid())
+                {
+                        if(owner != -1)
+                        {
+                                close(fds[0]);
+                                close(fds[1]);
+                        }
+
+                        owner = getpid();
+                        if(pipe2(fds, O_CLOEXEC) < 0)
+                        {
+                                fds[0] = fds[1] = -1;
+                        }
+                }
+
+                return fds[0] < 0 ? nullptr : fds;
+        }
+
+        /* reads exactly 'len' bytes that are known to be available from 'fd' */
+        static bool read_exact(const int fd, char* buf, std::size_t len)
+        {
+                while(len != 0)
+                {
+                        const ssize_t n = ::read(fd, buf, len);
+                        if(n < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+
+                        if(n <= 0)
+                        {
+                                return false;
+                        }
+
+                        buf += n;
+                        len -= static_cast<std::size_t>(n);
+                }
+
+                return true;
+        }
+
+        static LineStatus read_pipe(const int fd, std::string& line)
+        {
+                const int* scratch = scratch_pipe();
+                if(scratch == nullptr)
+                {
+                        return read_bytes(fd, line);
+                }
+
+                std::array<char, MAX_BLOCK> block;
+                while(true)
+                {
+                        /* copies what's in the pipe without consuming it; blocks until
+                         * there is something or all writers are gone */
+                        ssize_t n;
+                        do
+                        {
+                                n = tee(fd, scratch[1], MAX_BLOCK, 0);
+                        } while(n < 0 && errno == EINTR);
+
+                        if(n < 0)
+                        {
+                                return (errno == EINVAL) ? read_bytes(fd, line) : LineStatus::ERROR;
+                        }
+
+                        if(n == 0)
+                        {
+                                return LineStatus::UNTERMINATED;
+                        }
+
+                        const auto len = static_cast<std::size_t>(n);
+                        if(!read_exact(scratch[0], block.data(), len))
+                        {
+                                return LineStatus::ERROR;
+                        }
+
+                        const auto* nl = static_cast<const char*>(std::memchr(block.data(), '\n', len));
+                        const std::size_t consumed =
+                            (nl != nullptr) ? static_cast<std::size_t>(nl - block.data()) + 1 : len;
+
+                        /* now take the peeked bytes, up to and including the newline */
+                        if(!read_exact(fd, block.data(), consumed))
+                        {
+                                return LineStatus::ERROR;
+                        }
+
+                        if(nl != nullptr)
+                        {
+                                line.append(block.data(), consumed - 1);
+                                return LineStatus::COMPLETE;
+                        }
+
+                        line.append(block.data(), consumed);
+                }
+        }
+
+        static LineStatus read_socket(const int fd, std::string& line)
+        {
+                std::array<char, MAX_BLOCK> block;
+                while(true)
+                {
+                        const ssize_t n = recv(fd, block.data(), MAX_BLOCK, MSG_PEEK);
+                        if(n < 0)
+                        {
+                                if(errno == EINTR)
+                                {
+                                        continue;
+                                }
+
+                                return (errno == ENOTSOCK) ? read_bytes(fd, line) : LineStatus::ERROR;
+                        }
+
+                        if(n == 0)
+                        {
+                                return LineStatus::UNTERMINATED;
+                        }
+
+                        const auto len = static_cast<std::size_t>(n);
+                        const auto* nl = static_cast<const char*>(std::memchr(block.data(), '\n', len));
+                        const std::size_t consumed =
+                            (nl != nullptr) ? static_cast<std::size_t>(nl - block.data()) + 1 : len;
+
+                        if(!read_exact(fd, block.data(), consumed))
+                        {
+                                return LineStatus::ERROR;
+                        }
+
+                        if(nl != nullptr)
+                        {
+                                line.append(block.data(), consumed - 1);
+                                return LineStatus::COMPLETE;
+                        }
+
+                        line.append(block.data(), consumed);
+                }
+        }
+
+        static LineStatus read_bytes(const int fd, std::string& line)
+        {
+                while(true)
+                {
+                        char c;
+                        const ssize_t n = ::read(fd, &c, 1);
+                        if(n < 0)
+                        {
+                                if(errno == EINTR)
+                                {
+                                        continue;
+                                }
+
+                                return LineStatus::ERROR;
+                        }
+
+                        if(n == 0)
+                        {
+                                return LineStatus::UNTERMINATED;
+                        }
+
+                        if(c == '\n')
+                        {
+                                return LineStatus::COMPLETE;
+                        }
+
+                        line.push_back(c);
+                }
+        }
+
+        static std::uint64_t epoch;
+        static std::array<FdState, REDIR_FD_LIMIT + 1> fd_states;
+};
+
+std::uint64_t InputBuffers::epoch = 1;
+std::array<InputBuffers::FdState, REDIR_FD_LIMIT + 1> InputBuffers::fd_states = {};
@@ -1,8 +1,19 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <string>
 #include <filesystem>
 #include <optional>
+#include <map>
+#include <unordered_set>
+#include <list>
+#include <charconv>
+#include <bitset>
+#include <climits>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -10,6 +21,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <termios.h>
@@ -22,10 +43,22 @@
 
 namespace fs = std::filesystem;
 
+/* in the library, the shell's own names stay out of the way of the program's */
+#ifdef SHELLTER_LIBRARY
+namespace shellter::impl
+{
+#endif
+
 /* config and utils */
 #include "config.h"
 #include "util.h"
 
+/* shell variables */
+#include "vars.h"
+
+/* constants */
+static constexpr int REDIR_FD_LIMIT = 9;
+
 /* global variables */
 static bool running = true;
 static std::array<char, 256> current_user = {};
@@ -34,60 +67,135 @@ static fs::path home;
 static fs::path old_path;
 static bool old_path_set = false;
 static std::vector<std::string> line_history;
-static std::unordered_map<std::string, std::string> environment_vars;
+static VariableStore shell_vars;
+static int last_status = 0;
+static std::vector<std::string> positional_params = {"shellter"}; /* $0, $1, ... */
+static std::size_t function_depth = 0;
+static bool function_returning = false; /* set by 'return', until the function exits */
+static std::size_t source_depth = 0;
+static bool embedded = false; /* run by libshellter: the process isn't the shell's to end or replace */
+static volatile sig_atomic_t interrupted = 0; /* set by Ctrl-C in an interactive shell */
+static struct ShellOptions
+{
+        std::size_t pipe_size = 0; /* 0 means the kernel default */
+        bool arg_batching = false; /* split argument lists that don't fit in ARG_MAX */
+} shell_options;
+
+/* input buffering */
+#include "input.h"
+
+/* scripts */
+#include "parse.h"
+
+/* patterns */
+#include "glob.h"
+#include "regcache.h"
 
 /* builtin commands */
+#include "shellter_plugin.h"
+#include "plugin.h"
+#include "cond.h"
+#include "printf.h"
 #include "builtins.h"
 
+/* word expansion */
+#include "arith.h"
+#include "brace.h"
+#include "expand.h"
+
 /* class declarations */
-struct StdioFds;
+struct SavedFds;
 struct SyntaxErrorRegex;
 class BasicCommand;
-class LogicSequence;
 class PipeSequence;
 
 /* using declarations */
 using regsearch_result_t = std::pair<bool, boost::smatch>;
 
-/* template function declarations */
-template<bool>
-static int process_line(const std::string_view);
-
-static bool check_syntax_errors(const std::string&, const auto&);
-
 /* function declarations */
+static std::optional<int> parse_fd(const std::string_view);
+[[maybe_unused]] static int move_fd_high(const int);
+static int wait_child(const pid_t);
+[[noreturn]] static void exit_child(const int);
+static void import_environment();
+static void exec_command(char* const*, char* const*);
 static regsearch_result_t get_regsearch_result(const std::string&, const boost::regex&);
+static bool check_syntax_errors(const std::string&);
+static std::string mask_expansions(const std::string_view);
+static int run_source(const std::string_view);
+static void set_user_and_host();
+#ifndef SHELLTER_LIBRARY
 static void readline_free_history();
 static std::optional<std::string> readline_to_string(const char* const);
-static bool ends_in_special_seq(const std::string_view);
-static void set_user_and_host();
 static std::string get_prompt();
 static void loop();
 static void interrupt_child(const int);
+#endif
 
 /* class definitions */
-struct StdioFds
+struct SavedFds
 {
 public:
-        StdioFds()
+        SavedFds() = default;
+        SavedFds(const SavedFds&) = delete;
+        SavedFds& operator=(const SavedFds&) = delete;
+
+        ~SavedFds()
         {
-                for(int i = 0; i < 3; ++i)
+                /* restore in reverse order, so an fd redirected twice ends up with
+                 * its original description */
+                for(auto it = saved.rbegin(); it != saved.rend(); ++it)
                 {
-                        old[i] = dup(i);
+                        const auto [fd, copy] = *it;
+                        if(copy < 0)
+                        {
+                                close(fd);
+                                continue;
+                        }
+
+                        dup2(copy, fd);
+                        close(copy);
+                }
+
+                if(!saved.empty())
+                {
+                        InputBuffers::fds_changed();
                 }
         }
 
-        ~StdioFds()
+        void save(const int fd)
         {
-                for(int i = 0; i < 3; ++i)
+                InputBuffers::fds_changed();
+
+                for(const auto& entry : saved)
                 {
-                        dup2(old[i], i);
-                        close(old[i]);
+                        if(entry.first == fd)
+                        {
+                                return;
+                        }
                 }
+
+                /* keep the copy above the fds reachable by redirections; a negative
+                 * copy means 'fd' was closed and must be closed again on restore */
+                saved.emplace_back(fd, fcntl(fd, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT + 1));
+        }
+
+        /* make the current redirections permanent */
+        void release()
+        {
+                for(const auto& entry : saved)
+                {
+                        if(entry.second >= 0)
+                        {
+                                close(entry.second);
+                        }
+                }
+
+                saved.clear();
         }
 
 private:
-        std::array<int, 3> old;
+        std::vector<std::pair<int, int>> saved;
 };
 
 struct SyntaxErrorRegex
@@ -105,39 +213,66 @@ struct SyntaxErrorRegex
 class BasicCommand
 {
 public:
-        static std::optional<std::vector<std::string>> handle_redirections(const std::vector<std::string>&);
-        static int process(const std::string_view);
-};
+        static std::optional<std::vector<std::string>> handle_redirections(const std::vector<std::string>&,
+                                                                           SavedFds&);
+        /* runs the command made of 'words', as written in the source; when
+         * 'pipeline_pids' is given, the command runs in a child that isn't
+         * waited for and its pid is appended to the vector instead; when
+         * 'last' is set, nothing is left for the shell to do afterwards, so an
+         * external command replaces it rather than running in a child */
+        static int process(const std::span<const std::string>, std::vector<pid_t>* const = nullptr,
+                           const bool last = false);
 
-class LogicSequence
-{
-public:
-        static int process(const std::string_view);
+private:
+        /* brace expansions producing fewer words than this are never batched */
+        static constexpr std::uint64_t BATCH_MIN_WORDS = 4096;
+
+        /* with 'setopt argbatch', an external command whose brace expansions
+         * may not fit in ARG_MAX runs as many times as needed, each time with
+         * the words that fit, like xargs; returns nothing if the command isn't
+         * one to batch; in a pipeline, the batches run one after the other in a
+         * child that stands for the stage */
+        static std::optional<int> process_batched(const std::span<const std::string>,
+                                                  std::vector<pid_t>* const);
+        static int run_batches(const std::span<const std::string>, const std::size_t, const std::size_t);
+        static std::size_t arg_space(char* const*);
+        static int exec_args(std::vector<std::string>&, char* const*);
 };
 
 class PipeSequence
 {
 public:
-        static int process(const std::vector<std::string_view>&);
+        /* 'run_stage(i, pids)' runs stage 'i' with the pipes in place, the
+         * same way BasicCommand::process() does */
+        static int process(const std::size_t, const std::size_t, const auto&);
+
+        /* for a stage forked without exec: the read end of the pipe after the
+         * stage mustn't stay open in it, or the writers of the stage would
+         * block, rather than get SIGPIPE, once the next stage is gone */
+        static void close_next_input();
+
+private:
+        static std::size_t pipe_max_size();
+
+        static int next_input; /* -1 outside a stage that isn't the last */
 };
 
+int PipeSequence::next_input = -1;
+
+/* compiled programs */
+#include "vm.h"
+#include "source.h"
+
 /* static member function definitions */
-std::optional<std::vector<std::string>> BasicCommand::handle_redirections(const std::vector<std::string>& args)
+std::optional<std::vector<std::string>> BasicCommand::handle_redirections(const std::vector<std::string>& args,
+                                                                          SavedFds& saved_fds)
 {
-        static constexpr std::array<std::string_view, 8> redir_symbols = {
-            "1>>", "2>>", ">>", "1>", "2>", ">", "0<", "<"
-        };
-        static constexpr std::size_t appending_fds_limit = 2;
-        static constexpr std::array<int, 8> symbol_fds = {1, 2, 1, 1, 2, 1, 0, 0};
+        static constexpr std::array<std::string_view, 3> redir_symbols = {">>", ">", "<"};
+        static constexpr std::array<int, 3> default_fds = {1, 1, 0};
         static constexpr int OUTFILE_PERMS = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-        static constexpr std::array<int, 8> open_modes = {
-            O_WRONLY | O_CREAT | O_APPEND,
+        static constexpr std::array<int, 3> open_modes = {
             O_WRONLY | O_CREAT | O_APPEND,
-            O_WRONLY | O_CREAT | O_APPEND,
-            O_WRONLY | O_CREAT | O_TRUNC,
-            O_WRONLY | O_CREAT | O_TRUNC,
             O_WRONLY | O_CREAT | O_TRUNC,
-            O_RDONLY,
             O_RDONLY
         };
 
@@ -146,11 +281,22 @@ std::optional<std::vector<std::string>> BasicCommand::handle_redirections(const
         {
                 const std::string_view current_arg = args[i];
 
+                /* an optional fd number may precede the redirection symbol */
+                const std::size_t digits_end = current_arg.find_first_not_of("0123456789");
+                if(digits_end == current_arg.npos)
+                {
+                        args_after_redir.push_back(args[i]);
+                        continue;
+                }
+
+                const std::string_view fd_sv = current_arg.substr(0, digits_end);
+                const std::string_view symbol_sv = current_arg.substr(digits_end);
+
                 /* check if at least one symbol was found */
                 const auto it = std::find_if(redir_symbols.begin(), redir_symbols.end(),
                                              [&](const auto& symbol)
                                              {
-                                                     return current_arg.find(symbol) == 0;
+                                                     return symbol_sv.find(symbol) == 0;
                                              });
 
                 /* none were found */
@@ -164,12 +310,21 @@ std::optional<std::vector<std::string>> BasicCommand::handle_redirections(const
                 const auto symbol_pos = static_cast<std::size_t>(it - redir_symbols.begin());
                 const auto symbol_found = redir_symbols[symbol_pos];
 
+                const std::optional<int> opt_fd =
+                    fd_sv.empty() ? std::optional{default_fds[symbol_pos]} : parse_fd(fd_sv);
+                if(!opt_fd.has_value())
+                {
+                        print_err_fmt("shellter: bad file descriptor: {}\n", fd_sv);
+                        return std::nullopt;
+                }
+                const int fd = *opt_fd;
+
                 const char* filename = nullptr;
 
                 /* check for filename in current arg */
-                if(current_arg.size() > symbol_found.size())
+                if(symbol_sv.size() > symbol_found.size())
                 {
-                        filename = current_arg.data() + symbol_found.size();
+                        filename = symbol_sv.data() + symbol_found.size();
                 }
 
                 /* check for filename in next arg */
@@ -179,90 +334,110 @@ std::optional<std::vector<std::string>> BasicCommand::handle_redirections(const
                         ++i;
                 }
 
-                /* check if filename was found; if so, redirect that stream */
-                if(filename != nullptr)
+                /* filename is missing, report error and return */
+                if(filename == nullptr)
+                {
+                        print_err_fmt(
+                            "shellter: error in redirection symbol '{}': filename is missing\n",
+                            symbol_found);
+
+                        return std::nullopt;
+                }
+
+                /* check if filename refers to another fd */
+                const std::string_view filename_sv = filename;
+                if(filename_sv.find("&") == 0)
                 {
-                        /* check if filename refers to valid standard fd */
-                        const std::string_view filename_sv = filename;
-                        if(filename_sv == "&2" || filename_sv == "&1" || filename_sv == "&0")
+                        if(symbol_pos == 0)
                         {
-                                if(symbol_pos <= appending_fds_limit)
-                                {
-                                        print_err_fmt("shellter: can't redirect standard fd "
-                                                      "to another standard fd in appending mode\n");
-                                        return std::nullopt;
-                                }
+                                print_err_fmt("shellter: can't redirect fd to another fd "
+                                              "in appending mode\n");
+                                return std::nullopt;
+                        }
 
-                                const int new_fd = std::atoi(filename_sv.data() + 1);
-                                dup2(new_fd, symbol_fds[symbol_pos]);
+                        /* '&-' closes the fd */
+                        if(filename_sv == "&-")
+                        {
+                                saved_fds.save(fd);
+                                close(fd);
                                 continue;
                         }
-                        else if(filename_sv.find("&") == 0)
+
+                        const std::optional<int> opt_new_fd = parse_fd(filename_sv.substr(1));
+                        if(!opt_new_fd.has_value() || fcntl(*opt_new_fd, F_GETFD) < 0)
                         {
-                                print_err_fmt("shellter: looked for valid file descriptor, found: {}\n",
+                                print_err_fmt("shellter: looked for valid file descriptor, "
+                                              "found: {}\n",
                                               filename_sv);
                                 return std::nullopt;
                         }
 
-                        /* filename refers to an actual file */
-                        const int new_fd =
-                            (symbol_pos < redir_symbols.size() - 2)
-                                ? open(filename, open_modes[symbol_pos], OUTFILE_PERMS)
-                                : open(filename, open_modes[symbol_pos]);
-
-                        if(new_fd < 0)
+                        if(*opt_new_fd != fd)
                         {
-                                print_err_fmt("shellter: error opening {}: {}\n", filename,
-                                              strerror(errno));
-
-                                return std::nullopt;
+                                saved_fds.save(fd);
+                                dup2(*opt_new_fd, fd);
                         }
 
-                        dup2(new_fd, symbol_fds[symbol_pos]);
-                        close(new_fd);
-
                         continue;
                 }
 
-                /* filename is missing, report error and return */
-                print_err_fmt(
-                    "shellter: error in redirection symbol '{}': filename is missing\n",
-                    symbol_found);
+                /* filename refers to an actual file; save the target first, since
+                 * open() may hand out the very fd that is being redirected */
+                saved_fds.save(fd);
+                const int new_fd = open(filename, open_modes[symbol_pos], OUTFILE_PERMS);
+                if(new_fd < 0)
+                {
+                        print_err_fmt("shellter: error opening {}: {}\n", filename,
+                                      strerror(errno));
 
-                return std::nullopt;
+                        return std::nullopt;
+                }
+
+                if(new_fd != fd)
+                {
+                        dup2(new_fd, fd);
+                        close(new_fd);
+                }
         }
 
         return std::optional{std::move(args_after_redir)};
 }
 
-int BasicCommand::process(const std::string_view line_sv)
+int BasicCommand::process(const std::span<const std::string> words, std::vector<pid_t>* const pipeline_pids,
+                          const bool last)
 {
-        std::string str(line_sv);
-        boost::trim(str);
+        StatCache::invalidate();
 
-        /* split words, compress spaces */
-        std::vector<std::string> args;
-        boost::split(args, std::as_const(str), boost::is_any_of(" "), boost::token_compress_on);
+        if(shell_options.arg_batching)
+        {
+                const auto batched_status = process_batched(words, pipeline_pids);
+                if(batched_status.has_value())
+                {
+                        return *batched_status;
+                }
+        }
 
-        /* replace environment values */
-        for(std::size_t i = 0; i < args.size(); ++i)
+        /* expand variable references and patterns; array references and
+         * patterns may expand to several args */
+        std::vector<std::string> args;
+        args.reserve(words.size());
+        for(std::size_t i = 0; i < words.size(); ++i)
         {
-                if(i == 1 && (args[0] == std::string_view("addenv") ||
-                              args[0] == std::string_view("eaddenv")))
+                if(i == 1 && (words[0] == "addenv" || words[0] == "eaddenv"))
                 {
+                        args.push_back(words[i]);
                         continue;
                 }
 
-                const auto it = environment_vars.find(args[i]);
-                if(it != environment_vars.end())
+                if(!WordExpander::expand_words(words[i], args))
                 {
-                        args[i] = it->second;
+                        return EXIT_FAILURE;
                 }
         }
 
         /* check for redirection */
-        StdioFds old_fds{};
-        auto args_after_redir_opt = handle_redirections(args);
+        SavedFds saved_fds{};
+        auto args_after_redir_opt = handle_redirections(args, saved_fds);
 
         if(!args_after_redir_opt.has_value())
         {
@@ -275,98 +450,343 @@ int BasicCommand::process(const std::string_view line_sv)
                 return EXIT_SUCCESS;
         }
 
-        /* check for builtin command */
-        const auto builtin_it = builtin_funcs.find(args_after_redir.front());
-        if(builtin_it != builtin_funcs.cend())
+        /* 'exec' without a command keeps its redirections for the rest of the
+         * session; 'exec COMMAND' runs an external command in place of the shell */
+        const bool exec = (args_after_redir.front() == "exec");
+        if(exec)
+        {
+                args_after_redir.erase(args_after_redir.begin());
+                if(args_after_redir.empty())
+                {
+                        saved_fds.release();
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        /* 'command NAME' skips functions, and the builtins that only stand in
+         * for a program from PATH */
+        const bool command = (args_after_redir.front() == "command");
+        if(command)
+        {
+                args_after_redir.erase(args_after_redir.begin());
+                if(args_after_redir.empty())
+                {
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        /* check for functions, then for loaded and builtin commands; inside a
+         * pipeline, the ones that aren't the last stage run in a child, so they
+         * can't block on a full pipe */
+        const std::string_view name = args_after_redir.front();
+        const auto function = (exec || command) ? nullptr : ShellFunctions::find(name);
+        if(function != nullptr && pipeline_pids == nullptr)
+        {
+                return ShellFunctions::call(function, args_after_redir);
+        }
+
+        const auto* loaded = (exec || command) ? nullptr : LoadableBuiltins::find(name);
+        if(loaded != nullptr && pipeline_pids == nullptr)
+        {
+                return LoadableBuiltins::call(*loaded, args_after_redir);
+        }
+
+        const bool skip_builtin = exec || loaded != nullptr || (command && utility_builtins.contains(name));
+        const auto builtin_it = skip_builtin ? builtin_funcs.cend() : builtin_funcs.find(name);
+        if(builtin_it != builtin_funcs.cend() && pipeline_pids == nullptr)
         {
                 const auto r = builtin_it->second(args_after_redir);
 
                 return r;
         }
 
+        /* built before forking, so the cached environment survives in the shell */
+        char* const* envp = shell_vars.envp();
+
+        if((exec || last) && pipeline_pids == nullptr && !embedded)
+        {
+                /* when the command can't be run, the shell carries on as if it had failed in a child */
+                return exec_args(args_after_redir, envp);
+        }
+
         const pid_t child_pid = fork();
         if(child_pid == 0)
         {
-                /* construct array of char pointers (null terminated) */
-                std::vector<char*> arg_ptrs;
-                for(auto& str : args_after_redir)
+                PipeSequence::close_next_input();
+
+                if(function != nullptr)
                 {
-                        arg_ptrs.push_back(str.data());
+                        exit_child(ShellFunctions::call(function, args_after_redir));
                 }
-                arg_ptrs.push_back(nullptr);
 
-                execvp(arg_ptrs[0], arg_ptrs.data());
-                print_err_fmt("shellter: error calling execvp(): {}: {}\n", arg_ptrs[0],
-                              strerror(errno));
-                exit(1);
+                if(loaded != nullptr)
+                {
+                        exit_child(LoadableBuiltins::call(*loaded, args_after_redir));
+                }
+
+                if(builtin_it != builtin_funcs.cend())
+                {
+                        exit_child(builtin_it->second(args_after_redir));
+                }
+
+                exit_child(exec_args(args_after_redir, envp));
         }
 
-        int status;
-        do
+        if(pipeline_pids != nullptr)
         {
-                waitpid(child_pid, &status, WUNTRACED);
-        } while(!WIFEXITED(status) && !WIFSIGNALED(status));
-
-        /* restore stdin if previous command made it invisible
-         * and didn't restore it before returning / being closed */
-        struct termios term_status;
-        tcgetattr(0, &term_status);
+                pipeline_pids->push_back(child_pid);
+                return EXIT_SUCCESS;
+        }
 
-        if(!(term_status.c_lflag & ECHO))
+        /* an embedded shell can't be replaced, but the script ends there */
+        if(exec)
         {
-                term_status.c_lflag |= ECHO;
-                tcsetattr(0, TCSANOW, &term_status);
+                running = false;
         }
 
-        return status;
+        return wait_child(child_pid);
 }
 
-int LogicSequence::process(const std::string_view sub_line)
+std::optional<int> BasicCommand::process_batched(const std::span<const std::string> words,
+                                                 std::vector<pid_t>* const pipeline_pids)
 {
-        const auto or_pos = sub_line.find("||");
-        const auto and_pos = sub_line.find("&&");
+        /* the words between the first and the last brace expansion are the
+         * ones split among the batches */
+        std::size_t first = words.size();
+        std::size_t last = 0;
+        std::uint64_t total = 0;
+        for(std::size_t i = 1; i < words.size(); ++i)
+        {
+                if(words[i].find('{') == words[i].npos)
+                {
+                        continue;
+                }
 
-        if(or_pos != sub_line.npos)
+                const std::uint64_t count = BraceExpansion(words[i]).size();
+                if(count > 1)
+                {
+                        first = std::min(first, i);
+                        last = i;
+                        total += count;
+                }
+        }
+
+        if(first == words.size() || total < BATCH_MIN_WORDS)
+        {
+                return std::nullopt;
+        }
+
+        /* the command must be known before anything is expanded; builtins and
+         * functions take all their arguments at once */
+        const std::string_view name = words[0];
+        if(name.find_first_of("$\\'\"{*?[<>") != name.npos || name == "exec" || builtin_funcs.contains(name) ||
+           LoadableBuiltins::find(name) != nullptr || ShellFunctions::find(name) != nullptr)
+        {
+                return std::nullopt;
+        }
+
+        if(pipeline_pids != nullptr)
         {
-                const std::string_view left_line{sub_line.cbegin(), sub_line.cbegin() + or_pos};
-                const std::string_view right_line{sub_line.cbegin() + or_pos + 2, sub_line.cend()};
+                const pid_t child_pid = fork();
+                if(child_pid == 0)
+                {
+                        PipeSequence::close_next_input();
+                        exit_child(run_batches(words, first, last));
+                }
 
-                const int left_ret = process(left_line);
-                if(left_ret != EXIT_SUCCESS)
+                if(child_pid < 0)
                 {
-                        return process(right_line);
+                        print_err_fmt("shellter: fork: {}\n", strerror(errno));
+                        return EXIT_FAILURE;
                 }
 
-                return left_ret;
+                pipeline_pids->push_back(child_pid);
+                return EXIT_SUCCESS;
+        }
+
+        return run_batches(words, first, last);
+}
+
+/* runs the batches for the words between 'first' and 'last' */
+int BasicCommand::run_batches(const std::span<const std::string> words, const std::size_t first,
+                              const std::size_t last)
+{
+        /* the words around them go with every batch */
+        std::vector<std::string> prefix;
+        std::vector<std::string> suffix;
+        for(std::size_t i = 0; i < words.size(); ++i)
+        {
+                if((i < first || i > last) && !WordExpander::expand_words(words[i], (i < first) ? prefix : suffix))
+                {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        SavedFds saved_fds{};
+        auto prefix_opt = handle_redirections(prefix, saved_fds);
+        auto suffix_opt = prefix_opt.has_value() ? handle_redirections(suffix, saved_fds) : std::nullopt;
+        if(!prefix_opt.has_value() || !suffix_opt.has_value())
+        {
+                return EXIT_FAILURE;
+        }
+        prefix = std::move(*prefix_opt);
+        suffix = std::move(*suffix_opt);
+
+        char* const* envp = shell_vars.envp();
+        const std::size_t limit = arg_space(envp);
+        const auto cost = [](const std::string& arg)
+        {
+                return arg.size() + 1 + sizeof(char*);
+        };
+
+        std::size_t fixed = 0;
+        for(const auto& arg : prefix)
+        {
+                fixed += cost(arg);
         }
-        else if(and_pos != sub_line.npos)
+        for(const auto& arg : suffix)
+        {
+                fixed += cost(arg);
+        }
+
+        std::vector<std::string> batch(prefix);
+        std::size_t used = fixed;
+        int status = EXIT_SUCCESS;
+
+        /* runs the batch; a batch killed by a signal stops the rest */
+        const auto run_batch = [&]()
         {
-                const std::string_view left_line{sub_line.cbegin(), sub_line.cbegin() + and_pos};
-                const std::string_view right_line{sub_line.cbegin() + and_pos + 2, sub_line.cend()};
+                batch.insert(batch.end(), suffix.begin(), suffix.end());
 
-                const int left_ret = process(left_line);
-                if(left_ret == EXIT_SUCCESS)
+                const pid_t child_pid = fork();
+                if(child_pid == 0)
                 {
-                        return process(right_line);
+                        exit_child(exec_args(batch, envp));
                 }
 
-                return left_ret;
+                const int ret = (child_pid < 0) ? EXIT_FAILURE : wait_child(child_pid);
+                if(ret != EXIT_SUCCESS)
+                {
+                        status = ret;
+                }
+
+                batch.resize(prefix.size());
+                used = fixed;
+
+                return ret < 128;
+        };
+
+        std::vector<std::string> expanded;
+        std::string generated;
+        for(std::size_t i = first; i <= last; ++i)
+        {
+                const BraceExpansion braces(words[i]);
+                for(std::uint64_t j = 0; j < braces.size(); ++j)
+                {
+                        braces.word_at(j, generated);
+
+                        expanded.clear();
+                        if(!WordExpander::expand_paths(generated, expanded))
+                        {
+                                return EXIT_FAILURE;
+                        }
+
+                        for(auto& arg : expanded)
+                        {
+                                if(batch.size() > prefix.size() && used + cost(arg) > limit && !run_batch())
+                                {
+                                        return status;
+                                }
+
+                                used += cost(arg);
+                                batch.push_back(std::move(arg));
+                        }
+                }
         }
-        else
+
+        if(batch.size() > prefix.size())
         {
-                return process_line<false>(sub_line);
+                run_batch();
         }
+
+        return status;
+}
+
+/* the room for arguments: ARG_MAX, less the environment and some slack */
+std::size_t BasicCommand::arg_space(char* const* envp)
+{
+        static const std::size_t arg_max = []()
+        {
+                const long val = sysconf(_SC_ARG_MAX);
+                return (val > 0) ? static_cast<std::size_t>(val) : std::size_t(128 * 1024);
+        }();
+
+        std::size_t env_size = sizeof(char*);
+        for(char* const* env = envp; *env != nullptr; ++env)
+        {
+                env_size += std::strlen(*env) + 1 + sizeof(char*);
+        }
+
+        constexpr std::size_t SLACK = 4096;
+        return (arg_max > env_size + SLACK) ? arg_max - env_size - SLACK : 0;
+}
+
+/* returns the status of a command that couldn't be run: 127 if it wasn't
+ * found, 126 otherwise */
+int BasicCommand::exec_args(std::vector<std::string>& args, char* const* envp)
+{
+        /* construct array of char pointers (null terminated) */
+        std::vector<char*> arg_ptrs;
+        for(auto& str : args)
+        {
+                arg_ptrs.push_back(str.data());
+        }
+        arg_ptrs.push_back(nullptr);
+
+        exec_command(arg_ptrs.data(), envp);
+        const int error = errno;
+        print_err_fmt("shellter: error calling execve(): {}: {}\n", arg_ptrs[0], strerror(error));
+
+        return (error == ENOENT) ? 127 : 126;
+}
+
+std::size_t PipeSequence::pipe_max_size()
+{
+        static const std::size_t max_size = []()
+        {
+                std::size_t res = 1024 * 1024;
+
+                FILE* f = std::fopen("/proc/sys/fs/pipe-max-size", "r");
+                if(f != nullptr)
+                {
+                        unsigned long val;
+                        if(std::fscanf(f, "%lu", &val) == 1)
+                        {
+                                res = val;
+                        }
+                        std::fclose(f);
+                }
+
+                return res;
+        }();
+
+        return max_size;
 }
 
-int PipeSequence::process(const std::vector<std::string_view>& command_components)
+int PipeSequence::process(const std::size_t len, const std::size_t pipe_size, const auto& run_stage)
 {
-        const int fd_old_in = dup(0);
-        const int fd_old_out = dup(1);
+        const int fd_old_in = fcntl(0, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT + 1);
+        const int fd_old_out = fcntl(1, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT + 1);
 
         int fd_command_input = dup(fd_old_in);
         int fd_command_output;
 
-        const std::size_t len = command_components.size();
+        /* all stages but the last run concurrently and are waited for at the end */
+        std::vector<pid_t> pids;
+
+        /* a capacity the kernel refuses is reported once per pipeline */
+        bool pipe_size_failed = false;
+
         int ret = EXIT_FAILURE;
         for(std::size_t i = 0; i < len; ++i)
         {
@@ -380,9 +800,21 @@ int PipeSequence::process(const std::vector<std::string_view>& command_component
                 }
                 else
                 {
-                        /* set up pipe */
+                        /* set up pipe; the ends stay out of the children until dup2()ed */
                         int fd_pipe[2];
-                        pipe(fd_pipe);
+                        pipe2(fd_pipe, O_CLOEXEC);
+
+                        if(pipe_size != 0)
+                        {
+                                const auto capacity = std::min(pipe_size, pipe_max_size());
+                                if(fcntl(fd_pipe[1], F_SETPIPE_SZ, static_cast<int>(capacity)) == -1 &&
+                                   !pipe_size_failed)
+                                {
+                                        print_err_fmt("shellter: can't set pipe capacity to {}: {}\n",
+                                                      capacity, strerror(errno));
+                                        pipe_size_failed = true;
+                                }
+                        }
 
                         fd_command_output = fd_pipe[1];
                         fd_command_input = fd_pipe[0];
@@ -390,19 +822,181 @@ int PipeSequence::process(const std::vector<std::string_view>& command_component
 
                 dup2(fd_command_output, 1);
                 close(fd_command_output);
+                InputBuffers::fds_changed();
 
-                ret = BasicCommand::process(command_components[i]);
+                next_input = (i == len - 1) ? -1 : fd_command_input;
+                ret = run_stage(i, (i == len - 1) ? nullptr : &pids);
         }
 
+        next_input = -1;
+
         dup2(fd_old_in, 0);
         dup2(fd_old_out, 1);
         close(fd_old_in);
         close(fd_old_out);
+        InputBuffers::fds_changed();
+
+        for(const pid_t pid : pids)
+        {
+                wait_child(pid);
+        }
 
         return ret;
 }
 
+void PipeSequence::close_next_input()
+{
+        if(next_input >= 0)
+        {
+                close(next_input);
+                next_input = -1;
+        }
+}
+
 /* function definitions */
+std::optional<int> parse_fd(const std::string_view fd_sv)
+{
+        /* only single digit fds can be redirected */
+        if(fd_sv.size() != 1 || fd_sv[0] < '0' || fd_sv[0] > '9')
+        {
+                return std::nullopt;
+        }
+
+        return fd_sv[0] - '0';
+}
+
+int move_fd_high(const int fd)
+{
+        /* keep fds used by the shell itself out of reach of redirections */
+        const int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT + 1);
+        close(fd);
+
+        return new_fd;
+}
+
+/* ends a child of the shell; the child of a program using the library must not
+ * run the program's exit handlers or flush its stdio buffers a second time */
+void exit_child(const int status)
+{
+        if(embedded)
+        {
+                _exit(status);
+        }
+
+        exit(status);
+}
+
+int wait_child(const pid_t child_pid)
+{
+        int status;
+        do
+        {
+                waitpid(child_pid, &status, WUNTRACED);
+        } while(!WIFEXITED(status) && !WIFSIGNALED(status));
+
+        /* restore stdin if previous command made it invisible
+         * and didn't restore it before returning / being closed */
+        struct termios term_status;
+        tcgetattr(0, &term_status);
+
+        if(!(term_status.c_lflag & ECHO))
+        {
+                term_status.c_lflag |= ECHO;
+                tcsetattr(0, TCSANOW, &term_status);
+        }
+
+        /* like other shells, a command killed by a signal has a status of 128 + N */
+        if(WIFSIGNALED(status))
+        {
+                return 128 + WTERMSIG(status);
+        }
+
+        return WEXITSTATUS(status);
+}
+
+void import_environment()
+{
+        for(char** env = environ; *env != nullptr; ++env)
+        {
+                const std::string_view entry = *env;
+                const auto eq_pos = entry.find('=');
+                if(eq_pos == entry.npos)
+                {
+                        continue;
+                }
+
+                const auto name = entry.substr(0, eq_pos);
+                shell_vars.set(name, std::string(entry.substr(eq_pos + 1)));
+                shell_vars.set_exported(name, true);
+        }
+}
+
+void exec_command(char* const* argv, char* const* envp)
+{
+        /* files without a recognized format are run as shell scripts */
+        const auto try_exec = [&](const char* file)
+        {
+                execve(file, argv, envp);
+                if(errno != ENOEXEC)
+                {
+                        return;
+                }
+
+                std::vector<char*> sh_argv = {const_cast<char*>("/bin/sh"), const_cast<char*>(file)};
+                for(char* const* arg = argv + 1; *arg != nullptr; ++arg)
+                {
+                        sh_argv.push_back(*arg);
+                }
+                sh_argv.push_back(nullptr);
+
+                execve(sh_argv[0], sh_argv.data(), envp);
+        };
+
+        /* names containing a slash are run as they are, others are searched in $PATH */
+        const std::string_view name = argv[0];
+        if(name.find('/') != name.npos)
+        {
+                try_exec(argv[0]);
+                return;
+        }
+
+        const auto* path_var = shell_vars.find("PATH");
+        std::string_view path = (path_var != nullptr) ? std::string_view(path_var->value)
+                                                      : "/usr/local/bin:/usr/bin:/bin";
+
+        int saved_errno = ENOENT;
+        std::string candidate;
+        while(true)
+        {
+                const auto colon_pos = path.find(':');
+                const auto dir = path.substr(0, colon_pos);
+
+                candidate.assign(dir.empty() ? "." : dir);
+                candidate += '/';
+                candidate += name;
+
+                try_exec(candidate.c_str());
+
+                /* remember a permission problem, unless the name turns up later */
+                if(errno == EACCES)
+                {
+                        saved_errno = EACCES;
+                }
+                else if(errno != ENOENT && errno != ENOTDIR)
+                {
+                        return;
+                }
+
+                if(colon_pos == path.npos)
+                {
+                        break;
+                }
+                path.remove_prefix(colon_pos + 1);
+        }
+
+        errno = saved_errno;
+}
+
 regsearch_result_t get_regsearch_result(const std::string& line, const boost::regex& reg_expr)
 {
         boost::smatch match_array;
@@ -410,8 +1004,22 @@ regsearch_result_t get_regsearch_result(const std::string& line, const boost::re
         return {found, std::move(match_array)};
 }
 
-bool check_syntax_errors(const std::string& line, const auto& possible_syntax_errs)
+bool check_syntax_errors(const std::string& line)
 {
+        /* regular expressions for the syntax errors the parser leaves to us: bad
+         * redirection symbols, which end up inside words */
+        static const std::array<SyntaxErrorRegex, 2> possible_syntax_errs =
+        {{
+             {
+                 "shellter: syntax error: unrecognized sequence of special characters: '{}'\n",
+                 ">{3,}|<{2,}"
+             },
+             {
+                 "shellter: syntax error: bad file descriptor (only fds 0-9 accepted): '{}'\n",
+                 "><|[><]\\s+[><]|([^\\d\\s<>]|\\S\\d)[<>]"
+             }
+        }};
+
         for(auto& possible_err : possible_syntax_errs)
         {
                 const auto match_res = get_regsearch_result(line, possible_err.reg);
@@ -425,83 +1033,108 @@ bool check_syntax_errors(const std::string& line, const auto& possible_syntax_er
         return false;
 }
 
-void readline_free_history()
+std::string mask_expansions(const std::string_view line)
 {
-        HISTORY_STATE* myhist = history_get_history_state();
-        HIST_ENTRY** mylist = history_list();
+        /* blank out quoted text, escaped characters, ${...} and $((...)), keeping
+         * the offsets, so that searching the copy for operators doesn't look
+         * into them */
+        std::string masked(line);
 
-        for(int i = 0; i < myhist->length; i++)
+        std::size_t pos = 0;
+        while(pos < line.size())
         {
-                free_history_entry(mylist[i]);
+                std::size_t end = pos + 1;
+                if(line[pos] == '\\')
+                {
+                        end = pos + 2;
+                }
+                else if(line[pos] == '\'' || line[pos] == '"' || Lexer::is_expansion(line, pos))
+                {
+                        end = Lexer::skip_quoted(line, pos);
+                }
+                else
+                {
+                        ++pos;
+                        continue;
+                }
+
+                end = std::min(end, line.size());
+                std::fill(masked.begin() + static_cast<std::ptrdiff_t>(pos),
+                          masked.begin() + static_cast<std::ptrdiff_t>(end), '_');
+                pos = end;
         }
 
-        free(myhist);
-        free(mylist);
+        return masked;
 }
 
-std::optional<std::string> readline_to_string(const char* const prompt)
+int run_source(const std::string_view source)
 {
-        char* buf = readline(prompt);
-        if(buf == nullptr)
+        list_t tree;
+        const auto status = Parser::parse(source, tree);
+        if(status == Parser::Status::INCOMPLETE)
         {
-                return std::nullopt;
+                print_err_fmt("shellter: syntax error: unexpected end of file\n");
         }
 
-        const std::string res = buf;
-        free(buf);
-
-        return res;
-}
-
-template<bool CAN_HAVE_LOGICAL_OPERATORS>
-int process_line(const std::string_view line)
-{
-        if constexpr(CAN_HAVE_LOGICAL_OPERATORS)
+        if(status != Parser::Status::OK)
         {
-                /* line is a logical sequence */
-                if(line.find("||") != line.npos || line.find("&&") != line.npos)
-                {
-                        return LogicSequence::process(line);
-                }
+                return 2;
         }
 
-        /* split on pipe operator */
-        std::vector<std::string_view> pipe_strs;
-        boost::split_regex(pipe_strs, line, boost::regex("(?<![|])[|](?![|])"));
-
-        /* line is a pipe command */
-        if(pipe_strs.size() > 1)
+        Program program;
+        if(!Compiler::compile(tree, program))
         {
-                return PipeSequence::process(pipe_strs);
+                return 2;
         }
 
-        /* line is a basic command */
-        return BasicCommand::process(line);
+        return Interpreter::run_script(program);
 }
 
-bool ends_in_special_seq(const std::string_view line)
+void set_user_and_host()
 {
-        const std::size_t len = line.size();
+        cuserid(current_user.data());
+        gethostname(current_host.data(), sizeof(current_host));
 
-        if(line.back() == '|')
+        if(geteuid() != 0)
         {
-                return true;
+                home = std::string("/home/") + current_user.data();
         }
+        else
+        {
+                home = std::string("/") + current_user.data();
+        }
+}
+
+#ifndef SHELLTER_LIBRARY
+void readline_free_history()
+{
+        HISTORY_STATE* myhist = history_get_history_state();
+        HIST_ENTRY** mylist = history_list();
 
-        if(len > 1 && std::string_view(line.cend() - 2, line.cend()) == "&&")
+        for(int i = 0; i < myhist->length; i++)
         {
-                return true;
+                free_history_entry(mylist[i]);
         }
 
-        return false;
+        free(myhist);
+        free(mylist);
 }
 
-void set_user_and_host()
+std::optional<std::string> readline_to_string(const char* const prompt)
 {
-        cuserid(current_user.data());
-        gethostname(current_host.data(), sizeof(current_host));
+        char* buf = readline(prompt);
+        if(buf == nullptr)
+        {
+                return std::nullopt;
+        }
+
+        const std::string res = buf;
+        free(buf);
+
+        return res;
 }
 
+
 std::string get_prompt()
 {
         std::string path_str = fs::current_path().c_str();
@@ -517,23 +1150,6 @@ std::string get_prompt()
 
 void loop()
 {
-        /* regular expressions for syntax errors */
-        const std::array<SyntaxErrorRegex, 3> possible_syntax_errs =
-        {{
-             {
-                 "shellter: syntax error: unrecognized sequence of special characters: '{}'\n",
-                 ">{3,}|<{2,}|[|]{3,}|[&]{3,}|(&[|]|[|]&)[&\\|]*|[|][|][&\\|]+"
-             },
-             {
-                 "shellter: syntax error: empty command between tokens: '{}'\n",
-                 "((?<![|])[|](?![|])|&&|[|][|])\\s+((?<![|])[|](?![|])|&&|[|][|])"
-             },
-             {
-                 "shellter: syntax error: bad file descriptor (only standard fds accepted): '{}'\n",
-                 "><|[><]\\s+[><]|([^0\\s>]|[\\S]{2,})<|([^12\\s>]|[\\S]{2,})(?<!>)>{1,}"
-             }
-        }};
-
         while(running)
         {
                 const auto prompt = get_prompt();
@@ -552,51 +1168,53 @@ void loop()
                         continue;
                 }
 
-                while(ends_in_special_seq(line))
+                /* keep reading while the command is incomplete: open quotes, a
+                 * trailing '|' or '&&', an 'if' without its 'fi' */
+                list_t tree;
+                Parser::Status status = Parser::parse(line, tree);
+                while(status == Parser::Status::INCOMPLETE)
                 {
                         const auto opt_aux = readline_to_string("> ");
                         if(!opt_aux.has_value())
                         {
+                                print_err_fmt("shellter: syntax error: unexpected end of file\n");
                                 return;
                         }
 
-                        const auto& aux = *opt_aux;
+                        line += '\n';
+                        line += *opt_aux;
 
-                        line += ' ' + aux;
-                        boost::trim_right(line);
+                        tree.clear();
+                        status = Parser::parse(line, tree);
                 }
 
-
                 /* add line to history */
                 add_history(line.c_str());
                 line_history.push_back(line);
 
-                std::vector<std::string> separate_commands;
-                boost::split(separate_commands, std::as_const(line), boost::is_any_of(";"));
-
-                for(auto& sep_line : separate_commands)
+                if(status != Parser::Status::OK)
                 {
-                        boost::trim(sep_line);
-
-                        if(sep_line.empty())
-                        {
-                                continue;
-                        }
-
-                        /* check for syntax errors */
-                        if(check_syntax_errors(sep_line, possible_syntax_errs))
-                        {
-                                continue;
-                        }
+                        last_status = 2;
+                        continue;
+                }
 
-                        /* line is valid, process it */
-                        process_line<true>(sep_line);
+                /* line is valid, run it */
+                Program program;
+                if(Compiler::compile(tree, program))
+                {
+                        Interpreter::run(program);
+                }
+                else
+                {
+                        last_status = 2;
                 }
         }
 }
 
 void interrupt_child(const int)
 {
+        interrupted = 1;
+
         /* putc() is not signal-safe */
         write(1, "\n", 1);
 
@@ -606,28 +1224,76 @@ void interrupt_child(const int)
         rl_redisplay();
 }
 
-int main()
+#endif
+
+#ifdef SHELLTER_LIBRARY
+} // namespace shellter::impl
+
+/* the library */
+#include "shellter.h"
+#include "embed.h"
+#include "executor.h"
+#else
+#include "server.h"
+
+int main(int argc, char** argv)
 {
+        /* a client has nothing to set up */
+        if(argc == 4 && argv[1] == std::string_view("--client"))
+        {
+                return CommandServer::request(argv[2], argv[3]);
+        }
+
         /* misc inits */
         rl_outstream = stderr;
         if(!isatty(0) || !isatty(2))
         {
-                FILE* devnull = std::fopen("/dev/null", "w");
+                FILE* devnull = fdopen(move_fd_high(open("/dev/null", O_WRONLY)), "w");
                 rl_outstream = devnull;
         }
 
         signal(SIGINT, &interrupt_child);
 
+        import_environment();
+
         set_user_and_host();
-        if(geteuid() != 0)
+
+        if(argc > 2 && argv[1] == std::string_view("--server"))
         {
-                home = std::string("/home/") + current_user.data();
+                return CommandServer::serve(argv[2], {argv + 3, argv + argc});
         }
-        else
+
+        /* scripts run without a prompt */
+        /* 'shellter -c COMMANDS [NAME [ARG]...]' and 'shellter FILE [ARG]...': the
+         * name and the arguments become $0, $1, ... */
+        if(argc > 2 && argv[1] == std::string_view("-c"))
         {
-                home = std::string("/") + current_user.data();
+                if(argc > 3)
+                {
+                        positional_params.assign(argv + 3, argv + argc);
+                }
+                return run_source(argv[2]);
+        }
+
+        if(argc > 1)
+        {
+                positional_params.assign(argv + 1, argv + argc);
+
+                std::ifstream script(argv[1], std::ios::binary);
+                if(!script)
+                {
+                        print_err_fmt("shellter: {}: {}\n", argv[1], strerror(errno));
+                        return 127;
+                }
+
+                const std::string source{std::istreambuf_iterator<char>(script),
+                                         std::istreambuf_iterator<char>()};
+                return run_source(source);
         }
 
         loop();
         readline_free_history();
+
+        return last_status;
 }
+#endif
@@ -0,0 +1,1015 @@
+/* the shell grammar
+ *
+ * the input is split into tokens once, then parsed into a syntax tree of
+ * lists, and-or lists, pipelines and commands; words are kept as views into the
+ * source text, quotes included, and are only expanded when the command runs */
+struct Token
+{
+        enum class Type : std::uint8_t
+        {
+                WORD,
+                LINEBREAK,
+                SEMI,   /* ; */
+                DSEMI,  /* ;; */
+                AND_IF, /* && */
+                OR_IF,  /* || */
+                PIPE,   /* | */
+                AMP,    /* & */
+                LPAREN,
+                RPAREN,
+                END
+        };
+
+        Type type;
+        std::string_view text;
+};
+
+class Lexer
+{
+public:
+        /* returns false if the input ends inside a quote or an expansion */
+        static bool tokenize(const std::string_view src, std::vector<Token>& tokens)
+        {
+                using Type = Token::Type;
+
+                std::size_t pos = 0;
+                while(true)
+                {
+                        /* blanks and escaped newlines separate tokens */
+                        while(pos < src.size())
+                        {
+                                if(src[pos] == ' ' || src[pos] == '\t')
+                                {
+                                        ++pos;
+                                }
+                                else if(src.compare(pos, 2, "\\\n") == 0)
+                                {
+                                        pos += 2;
+                                }
+                                else
+                                {
+                                        break;
+                                }
+                        }
+
+                        if(pos >= src.size())
+                        {
+                                tokens.push_back({Type::END, {}});
+                                return true;
+                        }
+
+                        /* comments run to the end of the line */
+                        if(src[pos] == '#')
+                        {
+                                pos = std::min(src.find('\n', pos), src.size());
+                                continue;
+                        }
+
+                        static constexpr std::array<std::pair<std::string_view, Type>, 9> operators = {{
+                            {"&&", Type::AND_IF},
+                            {"||", Type::OR_IF},
+                            {";;", Type::DSEMI},
+                            {"\n", Type::LINEBREAK},
+                            {";", Type::SEMI},
+                            {"|", Type::PIPE},
+                            {"&", Type::AMP},
+                            {"(", Type::LPAREN},
+                            {")", Type::RPAREN},
+                        }};
+
+                        const auto op_it = std::find_if(operators.begin(), operators.end(),
+                                                        [&](const auto& op)
+                                                        {
+                                                                return src.compare(pos, op.first.size(), op.first) == 0;
+                                                        });
+                        if(op_it != operators.end())
+                        {
+                                tokens.push_back({op_it->second, src.substr(pos, op_it->first.size())});
+                                pos += op_it->first.size();
+                                continue;
+                        }
+
+                        const bool command_start = at_command_start(tokens);
+                        const auto end = word_end(src, pos);
+                        if(end == src.npos)
+                        {
+                                return false;
+                        }
+
+                        tokens.push_back({Type::WORD, src.substr(pos, end - pos)});
+                        pos = end;
+
+                        if(command_start && tokens.back().text == "[[")
+                        {
+                                pos = tokenize_conditional(src, pos, tokens);
+                                if(pos == src.npos)
+                                {
+                                        return false;
+                                }
+                        }
+                }
+        }
+
+        /* position just past the quoted string or expansion starting at 'pos';
+         * npos if it isn't terminated */
+        static std::size_t skip_quoted(const std::string_view src, std::size_t pos)
+        {
+                const char c = src[pos];
+                if(c == '\'')
+                {
+                        const auto close = src.find('\'', pos + 1);
+                        return (close == src.npos) ? close : close + 1;
+                }
+
+                if(c == '"')
+                {
+                        for(++pos; pos < src.size();)
+                        {
+                                if(src[pos] == '\\')
+                                {
+                                        pos += 2;
+                                }
+                                else if(src[pos] == '"')
+                                {
+                                        return pos + 1;
+                                }
+                                else if(is_expansion(src, pos))
+                                {
+                                        pos = skip_quoted(src, pos);
+                                        if(pos == src.npos)
+                                        {
+                                                return pos;
+                                        }
+                                }
+                                else
+                                {
+                                        ++pos;
+                                }
+                        }
+
+                        return src.npos;
+                }
+
+                /* ${...} or $((...)) */
+                const bool arith = (src.compare(pos, 3, "$((") == 0);
+                const char open = arith ? '(' : '{';
+                const char close = arith ? ')' : '}';
+
+                std::size_t depth = 0;
+                for(pos += arith ? 3 : 2; pos < src.size();)
+                {
+                        const char ch = src[pos];
+                        if(ch == '\\')
+                        {
+                                pos += 2;
+                                continue;
+                        }
+
+                        if(!arith && (ch == '\'' || ch == '"' || is_expansion(src, pos)))
+                        {
+                                pos = skip_quoted(src, pos);
+                                if(pos == src.npos)
+                                {
+                                        return pos;
+                                }
+                                continue;
+                        }
+
+                        if(ch == open)
+                        {
+                                ++depth;
+                        }
+                        else if(ch == close && depth-- == 0)
+                        {
+                                if(!arith)
+                                {
+                                        return pos + 1;
+                                }
+
+                                return (src.compare(pos, 2, "))") == 0) ? pos + 2 : src.npos;
+                        }
+
+                        ++pos;
+                }
+
+                return src.npos;
+        }
+
+        static bool is_expansion(const std::string_view src, const std::size_t pos)
+        {
+                return src.compare(pos, 2, "${") == 0 || src.compare(pos, 3, "$((") == 0;
+        }
+
+private:
+        /* true if a word at the end of 'tokens' would be the first of a command */
+        static bool at_command_start(const std::vector<Token>& tokens)
+        {
+                if(tokens.empty() || tokens.back().type != Token::Type::WORD)
+                {
+                        return true;
+                }
+
+                static constexpr std::array<std::string_view, 9> openers = {
+                    "if", "then", "elif", "else", "while", "until", "do", "!", "{"};
+
+                return std::find(openers.begin(), openers.end(), tokens.back().text) != openers.end();
+        }
+
+        /* inside '[[ ... ]]', only blanks separate words: '(', ')', '&&', '||'
+         * and '<' are words of the expression, and a regex such as '^(a|b)$'
+         * is a single word; returns the position after the closing ']]' */
+        static std::size_t tokenize_conditional(const std::string_view src, std::size_t pos,
+                                                std::vector<Token>& tokens)
+        {
+                while(true)
+                {
+                        pos = src.find_first_not_of(" \t\n", pos);
+                        if(pos == src.npos)
+                        {
+                                return pos;
+                        }
+
+                        const bool closing = src.compare(pos, 2, "]]") == 0 &&
+                                             (pos + 2 == src.size() || std::string_view(" \t\n;&|)").find(src[pos + 2]) != src.npos);
+                        const auto end = closing ? pos + 2 : word_end(src, pos, true);
+                        if(end == src.npos)
+                        {
+                                return end;
+                        }
+
+                        tokens.push_back({Token::Type::WORD, src.substr(pos, end - pos)});
+                        if(closing)
+                        {
+                                return end;
+                        }
+
+                        pos = end;
+                }
+        }
+
+        static std::size_t word_end(const std::string_view src, std::size_t pos, const bool blanks_only = false)
+        {
+                const std::size_t begin = pos;
+                while(pos < src.size())
+                {
+                        const char c = src[pos];
+                        if(c == ' ' || c == '\t' || c == '\n')
+                        {
+                                break;
+                        }
+
+                        if(!blanks_only && (c == ';' || c == '|' || c == '(' || c == ')'))
+                        {
+                                break;
+                        }
+
+                        /* '&' ends a word, except in redirections such as '2>&1' */
+                        if(!blanks_only && c == '&' && !(pos > begin && (src[pos - 1] == '>' || src[pos - 1] == '<')))
+                        {
+                                break;
+                        }
+
+                        if(c == '\\')
+                        {
+                                if(pos + 1 >= src.size())
+                                {
+                                        return src.npos;
+                                }
+
+                                pos += 2;
+                                continue;
+                        }
+
+                        if(c == '\'' || c == '"' || is_expansion(src, pos))
+                        {
+                                pos = skip_quoted(src, pos);
+                                if(pos == src.npos)
+                                {
+                                        return pos;
+                                }
+                                continue;
+                        }
+
+                        ++pos;
+                }
+
+                return pos;
+        }
+};
+
+/* aliases: the value of an alias is split into tokens when it's defined; the parser
+ * splices those tokens in place of the first word of a command, so using an
+ * alias never lexes its value again. With no aliases defined, the parser
+ * doesn't look anything up */
+class Aliases
+{
+public:
+        struct Alias
+        {
+                std::string value;
+                std::vector<Token> tokens; /* views into 'value', without the END token */
+                bool chain = false;        /* a trailing blank: the next word may be an alias too */
+        };
+
+        static bool empty()
+        {
+                return aliases.empty();
+        }
+
+        /* returns null if there's no alias called 'name' */
+        static const Alias* find(const std::string_view name)
+        {
+                const auto it = aliases.find(name);
+                return (it != aliases.end()) ? it->second.get() : nullptr;
+        }
+
+        /* fails if the value ends inside a quote */
+        static bool define(const std::string_view name, const std::string_view value)
+        {
+                /* the tokens point into the string, so it must not move */
+                auto alias = std::make_unique<Alias>();
+                alias->value.assign(value);
+                if(!Lexer::tokenize(alias->value, alias->tokens))
+                {
+                        return false;
+                }
+
+                alias->tokens.pop_back();
+                alias->chain = !value.empty() && (value.back() == ' ' || value.back() == '\t');
+
+                aliases.insert_or_assign(std::string(name), std::move(alias));
+                return true;
+        }
+
+        static bool remove(const std::string_view name)
+        {
+                const auto it = aliases.find(name);
+                if(it == aliases.end())
+                {
+                        return false;
+                }
+
+                aliases.erase(it);
+                return true;
+        }
+
+        static void clear()
+        {
+                aliases.clear();
+        }
+
+        /* the names, sorted */
+        static std::vector<std::string_view> names()
+        {
+                std::vector<std::string_view> res;
+                res.reserve(aliases.size());
+                for(const auto& entry : aliases)
+                {
+                        res.push_back(entry.first);
+                }
+                std::sort(res.begin(), res.end());
+
+                return res;
+        }
+
+        static bool is_valid_alias_name(const std::string_view name)
+        {
+                return !name.empty() && name.find_first_of("/$`=\"'\\ \t\n;|&()<>") == name.npos;
+        }
+
+        /* exchanges all the definitions, for the shells of the library */
+        using table_t = string_map_t<std::unique_ptr<Alias>>;
+        static void swap(table_t& other)
+        {
+                aliases.swap(other);
+        }
+
+private:
+        static string_map_t<std::unique_ptr<Alias>> aliases;
+};
+
+string_map_t<std::unique_ptr<Aliases::Alias>> Aliases::aliases;
+
+/* syntax tree */
+struct AndOrNode;
+using list_t = std::vector<AndOrNode>;
+
+struct CaseItem
+{
+        std::vector<std::string_view> patterns;
+        list_t body;
+};
+
+struct CommandNode
+{
+        enum class Kind : std::uint8_t
+        {
+                SIMPLE,
+                IF,
+                WHILE,
+                UNTIL,
+                FOR,
+                CASE,
+                FUNCTION,
+                GROUP,      /* { LIST; } */
+                SUBSHELL,   /* ( LIST ) */
+                CONDITIONAL /* [[ EXPRESSION ]] */
+        };
+
+        Kind kind = Kind::SIMPLE;
+
+        /* SIMPLE: the words of the command; FOR: the variable, then the words
+         * of the list; CASE: the word that is matched; FUNCTION: the name;
+         * CONDITIONAL: the words between the brackets */
+        std::vector<std::string_view> words;
+
+        /* IF: condition and branch pairs, then an optional else branch;
+         * WHILE and UNTIL: the condition and the body; FOR, FUNCTION, GROUP and
+         * SUBSHELL: the body */
+        std::vector<list_t> lists;
+
+        std::vector<CaseItem> items;
+
+        /* of compound commands: 'done > file' */
+        std::vector<std::string_view> redirections;
+};
+
+struct PipelineNode
+{
+        bool negate = false;
+        std::vector<CommandNode> commands;
+};
+
+struct AndOrNode
+{
+        std::vector<PipelineNode> pipelines;
+        std::vector<bool> and_ops; /* between pipelines: true for '&&', false for '||' */
+};
+
+class Parser
+{
+public:
+        enum class Status
+        {
+                OK,
+                INCOMPLETE, /* the input ended in the middle of a command */
+                ERROR
+        };
+
+        /* parses a whole program; syntax errors are reported here */
+        static Status parse(const std::string_view src, list_t& program)
+        {
+                Parser parser;
+                if(!Lexer::tokenize(src, parser.tokens))
+                {
+                        return Status::INCOMPLETE;
+                }
+
+                if(!parser.parse_list(program, false) || !parser.at(Token::Type::END))
+                {
+                        if(parser.status == Status::OK)
+                        {
+                                parser.unexpected();
+                        }
+                }
+
+                return parser.status;
+        }
+
+private:
+        using Type = Token::Type;
+
+        static bool is_reserved(const std::string_view word)
+        {
+                static constexpr std::array<std::string_view, 15> reserved = {
+                    "if", "then", "elif", "else", "fi", "while", "until", "for",
+                    "do", "done", "case", "esac", "in", "!", "}"};
+
+                return std::find(reserved.begin(), reserved.end(), word) != reserved.end();
+        }
+
+        /* words that end a list */
+        static bool is_terminator(const std::string_view word)
+        {
+                return word == "then" || word == "elif" || word == "else" || word == "fi" ||
+                       word == "do" || word == "done" || word == "esac" || word == "}";
+        }
+
+        const Token& current() const
+        {
+                return tokens[pos];
+        }
+
+        bool at(const Type type) const
+        {
+                return current().type == type;
+        }
+
+        bool at_word(const std::string_view word) const
+        {
+                return at(Type::WORD) && current().text == word;
+        }
+
+        void skip_newlines()
+        {
+                while(at(Type::LINEBREAK))
+                {
+                        ++pos;
+                }
+        }
+
+        bool fail(auto&& str, auto&&... args)
+        {
+                if(status == Status::OK)
+                {
+                        print_err_fmt(str, std::forward<decltype(args)>(args)...);
+                        status = Status::ERROR;
+                }
+
+                return false;
+        }
+
+        /* reports the current token, or that more input is needed */
+        bool unexpected()
+        {
+                if(at(Type::END))
+                {
+                        status = (status == Status::OK) ? Status::INCOMPLETE : status;
+                        return false;
+                }
+
+                const std::string_view text = at(Type::LINEBREAK) ? "newline" : current().text;
+                return fail("shellter: syntax error near unexpected token '{}'\n", text);
+        }
+
+        bool expect_word(const std::string_view word)
+        {
+                skip_newlines();
+                if(!at_word(word))
+                {
+                        return unexpected();
+                }
+
+                ++pos;
+                return true;
+        }
+
+        /* list := and_or ((';' | '\n') and_or)*, up to a terminator; 'required'
+         * lists can't be empty */
+        bool parse_list(list_t& list, const bool required)
+        {
+                skip_newlines();
+                while(!at(Type::END) && !at(Type::DSEMI) && !at(Type::RPAREN) &&
+                      !(at(Type::WORD) && is_terminator(current().text)))
+                {
+                        list.emplace_back();
+                        if(!parse_and_or(list.back()))
+                        {
+                                return false;
+                        }
+
+                        if(at(Type::AMP))
+                        {
+                                return fail("shellter: background jobs are not supported\n");
+                        }
+
+                        if(!at(Type::SEMI) && !at(Type::LINEBREAK))
+                        {
+                                break;
+                        }
+
+                        ++pos;
+                        skip_newlines();
+                }
+
+                if(required && list.empty())
+                {
+                        return unexpected();
+                }
+
+                return true;
+        }
+
+        bool parse_and_or(AndOrNode& node)
+        {
+                while(true)
+                {
+                        node.pipelines.emplace_back();
+                        if(!parse_pipeline(node.pipelines.back()))
+                        {
+                                return false;
+                        }
+
+                        if(!at(Type::AND_IF) && !at(Type::OR_IF))
+                        {
+                                return true;
+                        }
+
+                        node.and_ops.push_back(at(Type::AND_IF));
+                        ++pos;
+                        skip_newlines();
+                }
+        }
+
+        bool parse_pipeline(PipelineNode& node)
+        {
+                if(at_word("!"))
+                {
+                        node.negate = true;
+                        ++pos;
+                }
+
+                while(true)
+                {
+                        node.commands.emplace_back();
+                        if(!parse_command(node.commands.back()))
+                        {
+                                return false;
+                        }
+
+                        if(!at(Type::PIPE))
+                        {
+                                return true;
+                        }
+
+                        ++pos;
+                        skip_newlines();
+                }
+        }
+
+        bool parse_command(CommandNode& node)
+        {
+                if(at(Type::LPAREN))
+                {
+                        return parse_group(node) && parse_redirections(node);
+                }
+
+                if(!at(Type::WORD))
+                {
+                        return unexpected();
+                }
+
+                alias_chain = NO_CHAIN;
+                if(tokens[pos + 1].type != Type::LPAREN && expand_aliases() && !at(Type::WORD))
+                {
+                        /* an alias that expands to nothing */
+                        return true;
+                }
+
+                const std::string_view first = current().text;
+                bool ok = true;
+                if(first == "if")
+                {
+                        ok = parse_if(node);
+                }
+                else if(first == "while" || first == "until")
+                {
+                        ok = parse_while(node);
+                }
+                else if(first == "for")
+                {
+                        ok = parse_for(node);
+                }
+                else if(first == "case")
+                {
+                        ok = parse_case(node);
+                }
+                else if(first == "{")
+                {
+                        ok = parse_group(node);
+                }
+                else if(first == "[[")
+                {
+                        ok = parse_conditional(node);
+                }
+                else if(is_reserved(first))
+                {
+                        return unexpected();
+                }
+                else if(tokens[pos + 1].type == Type::LPAREN)
+                {
+                        ok = parse_function(node);
+                }
+                else
+                {
+                        while(at(Type::WORD))
+                        {
+                                node.words.push_back(current().text);
+                                ++pos;
+
+                                if(tokens.size() - pos == alias_chain)
+                                {
+                                        alias_chain = NO_CHAIN;
+                                        expand_aliases();
+                                }
+                        }
+
+                        return true;
+                }
+
+                return ok && parse_redirections(node);
+        }
+
+        /* replaces the alias at the current token with its tokens, until the
+         * first word isn't an alias or is one that was already expanded here;
+         * returns true if anything was replaced */
+        bool expand_aliases()
+        {
+                if(Aliases::empty())
+                {
+                        return false;
+                }
+
+                std::vector<std::string_view> expanded;
+                while(at(Type::WORD))
+                {
+                        const std::string_view name = current().text;
+                        const auto* alias = Aliases::find(name);
+                        if(alias == nullptr || std::find(expanded.begin(), expanded.end(), name) != expanded.end())
+                        {
+                                break;
+                        }
+
+                        expanded.push_back(name);
+
+                        const auto it = tokens.erase(tokens.begin() + static_cast<std::ptrdiff_t>(pos));
+                        tokens.insert(it, alias->tokens.begin(), alias->tokens.end());
+
+                        /* 'alias sudo="sudo "': the word after the expansion is checked too */
+                        if(alias->chain)
+                        {
+                                alias_chain = tokens.size() - pos - alias->tokens.size();
+                        }
+                }
+
+                return !expanded.empty();
+        }
+
+        /* redirections after a compound command */
+        bool parse_redirections(CommandNode& node)
+        {
+                while(at(Type::WORD))
+                {
+                        const std::string_view word = current().text;
+                        const auto symbol_pos = word.find_first_not_of("0123456789");
+                        if(symbol_pos == word.npos || (word[symbol_pos] != '<' && word[symbol_pos] != '>'))
+                        {
+                                return unexpected();
+                        }
+
+                        node.redirections.push_back(word);
+                        ++pos;
+
+                        /* the file name may be the next word */
+                        if(word.find_first_not_of("<>", symbol_pos) == word.npos && at(Type::WORD))
+                        {
+                                node.redirections.push_back(current().text);
+                                ++pos;
+                        }
+                }
+
+                return true;
+        }
+
+        bool parse_if(CommandNode& node)
+        {
+                node.kind = CommandNode::Kind::IF;
+                ++pos;
+
+                while(true)
+                {
+                        node.lists.emplace_back();
+                        if(!parse_list(node.lists.back(), true) || !expect_word("then"))
+                        {
+                                return false;
+                        }
+
+                        node.lists.emplace_back();
+                        if(!parse_list(node.lists.back(), true))
+                        {
+                                return false;
+                        }
+
+                        if(at_word("elif"))
+                        {
+                                ++pos;
+                                continue;
+                        }
+
+                        if(at_word("else"))
+                        {
+                                ++pos;
+                                node.lists.emplace_back();
+                                if(!parse_list(node.lists.back(), true))
+                                {
+                                        return false;
+                                }
+                        }
+
+                        return expect_word("fi");
+                }
+        }
+
+        bool parse_while(CommandNode& node)
+        {
+                node.kind = (current().text == "while") ? CommandNode::Kind::WHILE : CommandNode::Kind::UNTIL;
+                ++pos;
+
+                node.lists.resize(2);
+                return parse_list(node.lists[0], true) && expect_word("do") &&
+                       parse_list(node.lists[1], true) && expect_word("done");
+        }
+
+        bool parse_for(CommandNode& node)
+        {
+                node.kind = CommandNode::Kind::FOR;
+                ++pos;
+
+                if(!at(Type::WORD))
+                {
+                        return unexpected();
+                }
+
+                if(!is_valid_name(current().text))
+                {
+                        return fail("shellter: for: not a valid name: '{}'\n", current().text);
+                }
+
+                node.words.push_back(current().text);
+                ++pos;
+
+                /* 'for NAME in WORD...;' or just 'for NAME;' */
+                skip_newlines();
+                if(at_word("in"))
+                {
+                        ++pos;
+                        while(at(Type::WORD))
+                        {
+                                node.words.push_back(current().text);
+                                ++pos;
+                        }
+                }
+
+                if(at(Type::SEMI))
+                {
+                        ++pos;
+                }
+
+                node.lists.resize(1);
+                return expect_word("do") && parse_list(node.lists[0], true) && expect_word("done");
+        }
+
+        /* { LIST; } or ( LIST ) */
+        bool parse_group(CommandNode& node)
+        {
+                const bool subshell = at(Type::LPAREN);
+                node.kind = subshell ? CommandNode::Kind::SUBSHELL : CommandNode::Kind::GROUP;
+                ++pos;
+
+                node.lists.resize(1);
+                if(!parse_list(node.lists[0], true))
+                {
+                        return false;
+                }
+
+                if(!subshell)
+                {
+                        return expect_word("}");
+                }
+
+                skip_newlines();
+                if(!at(Type::RPAREN))
+                {
+                        return unexpected();
+                }
+
+                ++pos;
+                return true;
+        }
+
+        /* the lexer already split the expression into words */
+        bool parse_conditional(CommandNode& node)
+        {
+                node.kind = CommandNode::Kind::CONDITIONAL;
+                ++pos;
+
+                while(at(Type::WORD) && current().text != "]]")
+                {
+                        node.words.push_back(current().text);
+                        ++pos;
+                }
+
+                if(node.words.empty() || !at_word("]]"))
+                {
+                        return unexpected();
+                }
+
+                ++pos;
+                return true;
+        }
+
+        /* NAME() { LIST } */
+        bool parse_function(CommandNode& node)
+        {
+                node.kind = CommandNode::Kind::FUNCTION;
+
+                if(!is_valid_name(current().text))
+                {
+                        return fail("shellter: not a valid function name: '{}'\n", current().text);
+                }
+
+                node.words.push_back(current().text);
+                pos += 2;
+
+                if(!at(Type::RPAREN))
+                {
+                        return unexpected();
+                }
+                ++pos;
+
+                node.lists.resize(1);
+                return expect_word("{") && parse_list(node.lists[0], true) && expect_word("}");
+        }
+
+        bool parse_case(CommandNode& node)
+        {
+                node.kind = CommandNode::Kind::CASE;
+                ++pos;
+
+                if(!at(Type::WORD))
+                {
+                        return unexpected();
+                }
+
+                node.words.push_back(current().text);
+                ++pos;
+
+                if(!expect_word("in"))
+                {
+                        return false;
+                }
+
+                skip_newlines();
+                while(!at_word("esac"))
+                {
+                        CaseItem& item = node.items.emplace_back();
+
+                        /* [(] PATTERN [| PATTERN]... ) LIST ;; */
+                        if(at(Type::LPAREN))
+                        {
+                                ++pos;
+                        }
+
+                        while(true)
+                        {
+                                if(!at(Type::WORD))
+                                {
+                                        return unexpected();
+                                }
+
+                                item.patterns.push_back(current().text);
+                                ++pos;
+
+                                if(!at(Type::PIPE))
+                                {
+                                        break;
+                                }
+                                ++pos;
+                        }
+
+                        if(!at(Type::RPAREN))
+                        {
+                                return unexpected();
+                        }
+                        ++pos;
+
+                        if(!parse_list(item.body, false))
+                        {
+                                return false;
+                        }
+
+                        /* the last item doesn't need its ';;' */
+                        if(at(Type::DSEMI))
+                        {
+                                ++pos;
+                                skip_newlines();
+                        }
+                        else if(!at_word("esac"))
+                        {
+                                return unexpected();
+                        }
+                }
+
+                ++pos;
+                return true;
+        }
+
+        static constexpr std::size_t NO_CHAIN = static_cast<std::size_t>(-1);
+
+        std::vector<Token> tokens;
+        std::size_t pos = 0;
+        Status status = Status::OK;
+
+        /* tokens left from the word an alias ending in a blank is followed by */
+        std::size_t alias_chain = NO_CHAIN;
+};
@@ -0,0 +1,147 @@
+/* builtins loaded from shared objects with 'enable -f' (see shellter_plugin.h)
+ *
+ * a loaded builtin takes precedence over the compiled-in one with the same
+ * name; its object stays open until the builtin is removed or replaced */
+class LoadableBuiltins
+{
+public:
+        struct Entry
+        {
+                const shellter_builtin* builtin;
+                void* handle;
+        };
+
+        /* returns null if no builtin called 'name' was loaded */
+        static const Entry* find(const std::string_view name)
+        {
+                if(entries.empty())
+                {
+                        return nullptr;
+                }
+
+                const auto it = entries.find(name);
+                return (it != entries.end()) ? &it->second : nullptr;
+        }
+
+        /* loads builtin 'name' from the object at 'path'; reports why it failed */
+        static bool load(const std::string& path, const std::string_view name)
+        {
+                if(!is_valid_name(name))
+                {
+                        print_err_fmt("shellter: enable: not a valid builtin name: '{}'\n", name);
+                        return false;
+                }
+
+                void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+                if(handle == nullptr)
+                {
+                        print_err_fmt("shellter: enable: {}\n", dlerror());
+                        return false;
+                }
+
+                const auto symbol = fmt::format("shellter_builtin_{}", name);
+                const auto* builtin = static_cast<const shellter_builtin*>(dlsym(handle, symbol.c_str()));
+                if(builtin == nullptr || builtin->func == nullptr)
+                {
+                        print_err_fmt("shellter: enable: {}: no builtin '{}' ({} not found)\n", path, name, symbol);
+                        dlclose(handle);
+                        return false;
+                }
+
+                if(builtin->abi == 0 || builtin->abi > SHELLTER_PLUGIN_ABI)
+                {
+                        print_err_fmt("shellter: enable: {}: '{}' needs plugin ABI {}, this shell has {}\n", path,
+                                      name, builtin->abi, SHELLTER_PLUGIN_ABI);
+                        dlclose(handle);
+                        return false;
+                }
+
+                remove(name);
+                entries.emplace(std::string(name), Entry{builtin, handle});
+
+                return true;
+        }
+
+        /* returns false if no builtin called 'name' was loaded */
+        static bool remove(const std::string_view name)
+        {
+                const auto it = entries.find(name);
+                if(it == entries.end())
+                {
+                        return false;
+                }
+
+                dlclose(it->second.handle);
+                entries.erase(it);
+
+                return true;
+        }
+
+        static void list(FdWriter& out)
+        {
+                std::vector<std::string_view> names(entries.size());
+                std::transform(entries.begin(), entries.end(), names.begin(), [](const auto& entry)
+                               {
+                                       return std::string_view(entry.first);
+                               });
+                std::sort(names.begin(), names.end());
+
+                for(const auto name : names)
+                {
+                        const char* usage = entries.find(name)->second.builtin->usage;
+                        out.print("{}\t{}\n", name, (usage != nullptr) ? usage : "");
+                }
+        }
+
+        static int call(const Entry& entry, const std::vector<std::string>& args)
+        {
+                std::vector<char*> argv;
+                argv.reserve(args.size() + 1);
+                for(const auto& arg : args)
+                {
+                        argv.push_back(const_cast<char*>(arg.c_str()));
+                }
+                argv.push_back(nullptr);
+
+                static constexpr shellter_context context = {
+                    SHELLTER_PLUGIN_ABI, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, &get_var, &set_var
+                };
+
+                return entry.builtin->func(static_cast<int>(args.size()), argv.data(), &context) & 0xff;
+        }
+
+private:
+        static const char* get_var(const char* name)
+        {
+                const auto* var = shell_vars.find(name);
+                if(var == nullptr)
+                {
+                        return nullptr;
+                }
+
+                /* array elements aren't null terminated; the first one is copied */
+                if(var->array != nullptr)
+                {
+                        static std::string element;
+                        element.assign((var->array->size() > 0) ? (*var->array)[0] : std::string_view());
+                        return element.c_str();
+                }
+
+                return var->value.c_str();
+        }
+
+        static int set_var(const char* name, const char* value)
+        {
+                if(name == nullptr || value == nullptr || !is_valid_name(name))
+                {
+                        return -1;
+                }
+
+                shell_vars.set(name, value);
+                return 0;
+        }
+
+        static string_map_t<Entry> entries;
+};
+
+string_map_t<LoadableBuiltins::Entry> LoadableBuiltins::entries;
@@ -0,0 +1,610 @@
+/* the formatting engine of the 'printf' builtin
+ *
+ * a format string is translated once into literal runs and conversions, each
+ * conversion carrying the equivalent fmt replacement field ("%-8.3s" becomes
+ * "{:<8.3}"); translated formats are cached by their text, so a format used
+ * on every iteration of a loop is only parsed the first time */
+class PrintfFormat
+{
+public:
+        /* formats 'args' into 'out', reusing the format while arguments remain;
+         * returns false if an argument wasn't valid for its conversion */
+        static bool format(const std::string_view fmt_str, const std::vector<std::string_view>& args,
+                           std::string& out)
+        {
+                const PrintfFormat& compiled = lookup(fmt_str);
+
+                State state{args, 0, true};
+                do
+                {
+                        const std::size_t first = state.next;
+                        if(!compiled.apply(state, out))
+                        {
+                                break;
+                        }
+
+                        /* a format without conversions is printed once */
+                        if(state.next == first)
+                        {
+                                break;
+                        }
+                } while(state.next < args.size());
+
+                return state.ok;
+        }
+
+private:
+        static constexpr std::size_t CACHE_LIMIT = 64;
+
+        struct Conversion
+        {
+                char type;                 /* d, u, o, x, X, c, s, b, f, e, g, a (and uppercase) */
+                bool left = false;         /* '-' */
+                bool zero = false;         /* '0' */
+                char sign = '\0';          /* '+' or ' ' */
+                bool alternate = false;    /* '#' */
+                int width = -1;            /* -1: none, -2: from the arguments */
+                int precision = -1;        /* same */
+                std::string field;         /* the fmt replacement field, for fixed width and precision */
+        };
+
+        struct Segment
+        {
+                std::string literal;       /* printed before the conversion */
+                std::optional<Conversion> conv;
+        };
+
+        struct State
+        {
+                const std::vector<std::string_view>& args;
+                std::size_t next;
+                bool ok;
+
+                std::string_view take()
+                {
+                        return (next < args.size()) ? args[next++] : std::string_view();
+                }
+        };
+
+        static const PrintfFormat& lookup(const std::string_view fmt_str)
+        {
+                static string_map_t<PrintfFormat> cache;
+
+                const auto it = cache.find(fmt_str);
+                if(it != cache.end())
+                {
+                        return it->second;
+                }
+
+                if(cache.size() >= CACHE_LIMIT)
+                {
+                        cache.clear();
+                }
+
+                return cache.emplace(std::string(fmt_str), PrintfFormat(fmt_str)).first->second;
+        }
+
+        explicit PrintfFormat(const std::string_view fmt_str)
+        {
+                segments.emplace_back();
+
+                for(std::size_t i = 0; i < fmt_str.size(); ++i)
+                {
+                        const char c = fmt_str[i];
+                        if(c == '\\')
+                        {
+                                i = unescape(fmt_str, i, segments.back().literal, false);
+                                continue;
+                        }
+
+                        if(c != '%')
+                        {
+                                segments.back().literal.push_back(c);
+                                continue;
+                        }
+
+                        if(i + 1 < fmt_str.size() && fmt_str[i + 1] == '%')
+                        {
+                                segments.back().literal.push_back('%');
+                                ++i;
+                                continue;
+                        }
+
+                        const auto conv = parse_conversion(fmt_str, i);
+                        if(!conv.has_value())
+                        {
+                                /* not a valid conversion: printed as is */
+                                segments.back().literal.push_back('%');
+                                continue;
+                        }
+
+                        segments.back().conv = std::move(*conv);
+                        segments.emplace_back();
+                }
+        }
+
+        /* parses the conversion starting at the '%' at 'pos' and leaves 'pos' on
+         * its last character */
+        static std::optional<Conversion> parse_conversion(const std::string_view fmt_str,
+                                                          std::size_t& pos)
+        {
+                Conversion conv{};
+                std::size_t i = pos + 1;
+
+                for(; i < fmt_str.size(); ++i)
+                {
+                        const char c = fmt_str[i];
+                        if(c == '-')
+                        {
+                                conv.left = true;
+                        }
+                        else if(c == '0')
+                        {
+                                conv.zero = true;
+                        }
+                        else if(c == '+' || (c == ' ' && conv.sign != '+'))
+                        {
+                                conv.sign = c;
+                        }
+                        else if(c == '#')
+                        {
+                                conv.alternate = true;
+                        }
+                        else
+                        {
+                                break;
+                        }
+                }
+
+                const auto parse_number = [&](int& value)
+                {
+                        if(i < fmt_str.size() && fmt_str[i] == '*')
+                        {
+                                value = -2;
+                                ++i;
+                                return;
+                        }
+
+                        const auto [ptr, ec] =
+                            std::from_chars(fmt_str.data() + i, fmt_str.data() + fmt_str.size(), value);
+                        if(ec == std::errc())
+                        {
+                                i = static_cast<std::size_t>(ptr - fmt_str.data());
+                        }
+                };
+
+                parse_number(conv.width);
+                if(i < fmt_str.size() && fmt_str[i] == '.')
+                {
+                        ++i;
+                        conv.precision = 0;
+                        parse_number(conv.precision);
+                }
+
+                /* length modifiers mean nothing here */
+                while(i < fmt_str.size() && std::string_view("hlLqjzt").find(fmt_str[i]) != fmt_str.npos)
+                {
+                        ++i;
+                }
+
+                if(i >= fmt_str.size() ||
+                   std::string_view("diouxXcsbfFeEgGaA").find(fmt_str[i]) == fmt_str.npos)
+                {
+                        return std::nullopt;
+                }
+
+                conv.type = (fmt_str[i] == 'i') ? 'd' : fmt_str[i];
+                if(conv.width != -2 && conv.precision != -2)
+                {
+                        conv.field = make_field(conv, conv.width, conv.precision);
+                }
+
+                pos = i;
+                return conv;
+        }
+
+        /* the fmt replacement field for a conversion; integer precision is
+         * applied separately, since fmt has no notion of it */
+        static std::string make_field(const Conversion& conv, const int width, const int precision)
+        {
+                std::string field = "{:";
+
+                /* integers with a precision are formatted beforehand and
+                 * only padded here, like strings */
+                const bool integer = std::string_view("duoxX").find(conv.type) != std::string_view::npos;
+                const bool preformatted = integer && precision >= 0;
+                const bool numeric = !preformatted && std::string_view("sbc").find(conv.type) == std::string_view::npos;
+
+                if(conv.left)
+                {
+                        field.push_back('<');
+                }
+                else if(!numeric || !conv.zero)
+                {
+                        field.push_back('>');
+                }
+
+                if(numeric && conv.sign != '\0' && conv.type != 'u' && conv.type != 'o' &&
+                   conv.type != 'x' && conv.type != 'X')
+                {
+                        field.push_back(conv.sign);
+                }
+
+                if(numeric && conv.alternate && conv.type != 'd' && conv.type != 'u')
+                {
+                        field.push_back('#');
+                }
+
+                if(numeric && conv.zero && !conv.left)
+                {
+                        field.push_back('0');
+                }
+
+                if(width > 0)
+                {
+                        field.append(fmt::format_int(width).c_str());
+                }
+
+                if(precision >= 0 && !integer && conv.type != 'c')
+                {
+                        field.push_back('.');
+                        field.append(fmt::format_int(precision).c_str());
+                }
+
+                if(preformatted)
+                {
+                        field.push_back('}');
+                        return field;
+                }
+
+                switch(conv.type)
+                {
+                case 'u':
+                        field.push_back('d');
+                        break;
+                case 'c':
+                case 'b':
+                        break;
+                case 'F':
+                        /* fmt has no uppercase fixed notation */
+                        field.push_back('f');
+                        break;
+                default:
+                        field.push_back(conv.type);
+                        break;
+                }
+
+                field.push_back('}');
+                return field;
+        }
+
+        /* prints one pass over the format; returns false if a '\c' in a %b
+         * argument stopped the output */
+        bool apply(State& state, std::string& out) const
+        {
+                for(const auto& segment : segments)
+                {
+                        out.append(segment.literal);
+                        if(!segment.conv.has_value())
+                        {
+                                continue;
+                        }
+
+                        if(!convert(*segment.conv, state, out))
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        static bool convert(const Conversion& conv, State& state, std::string& out)
+        {
+                int width = conv.width;
+                int precision = conv.precision;
+                Conversion dynamic = conv;
+
+                if(width == -2)
+                {
+                        width = static_cast<int>(to_integer(state.take(), state));
+                        if(width < 0)
+                        {
+                                dynamic.left = true;
+                                width = -width;
+                        }
+                }
+
+                if(precision == -2)
+                {
+                        precision = static_cast<int>(to_integer(state.take(), state));
+                        precision = std::max(precision, -1);
+                }
+
+                const std::string field = (conv.field.empty()) ? make_field(dynamic, width, precision)
+                                                               : std::string();
+                const std::string_view spec = conv.field.empty() ? std::string_view(field)
+                                                                 : std::string_view(conv.field);
+                auto out_it = std::back_inserter(out);
+
+                const std::string_view arg = state.take();
+                switch(conv.type)
+                {
+                case 's':
+                        fmt::format_to(out_it, fmt::runtime(spec), arg);
+                        return true;
+                case 'c':
+                        fmt::format_to(out_it, fmt::runtime(spec), arg.substr(0, 1));
+                        return true;
+                case 'b':
+                {
+                        std::string expanded;
+                        bool stop = false;
+                        for(std::size_t i = 0; i < arg.size(); ++i)
+                        {
+                                if(arg[i] != '\\')
+                                {
+                                        expanded.push_back(arg[i]);
+                                        continue;
+                                }
+
+                                if(i + 1 < arg.size() && arg[i + 1] == 'c')
+                                {
+                                        stop = true;
+                                        break;
+                                }
+
+                                i = unescape(arg, i, expanded, true);
+                        }
+
+                        if(precision >= 0 && static_cast<std::size_t>(precision) < expanded.size())
+                        {
+                                expanded.resize(static_cast<std::size_t>(precision));
+                        }
+
+                        fmt::format_to(out_it, fmt::runtime(spec), expanded);
+                        return !stop;
+                }
+                case 'd':
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                {
+                        const std::int64_t value = to_integer(arg, state);
+                        if(precision < 0)
+                        {
+                                if(conv.type == 'd')
+                                {
+                                        fmt::format_to(out_it, fmt::runtime(spec), value);
+                                }
+                                else
+                                {
+                                        fmt::format_to(out_it, fmt::runtime(spec), static_cast<std::uint64_t>(value));
+                                }
+                                return true;
+                        }
+
+                        /* the precision is a minimum number of digits */
+                        fmt::format_to(out_it, fmt::runtime(spec), with_precision(conv, value, precision));
+                        return true;
+                }
+                default:
+                {
+                        const double value = to_double(arg, state);
+                        const auto begin = out.size();
+                        fmt::format_to(out_it, fmt::runtime(spec), value);
+                        if(conv.type == 'F')
+                        {
+                                std::transform(out.begin() + static_cast<std::ptrdiff_t>(begin), out.end(),
+                                               out.begin() + static_cast<std::ptrdiff_t>(begin),
+                                               [](const char c)
+                                               {
+                                                       return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+                                               });
+                        }
+                        return true;
+                }
+                }
+        }
+
+        static std::string with_precision(const Conversion& conv, const std::int64_t value,
+                                          const int precision)
+        {
+                std::string digits;
+                const bool negative = (conv.type == 'd' && value < 0);
+                const auto magnitude = negative ? 0 - static_cast<std::uint64_t>(value)
+                                                : static_cast<std::uint64_t>(value);
+
+                switch(conv.type)
+                {
+                case 'o':
+                        digits = fmt::format("{:o}", magnitude);
+                        break;
+                case 'x':
+                        digits = fmt::format("{:x}", magnitude);
+                        break;
+                case 'X':
+                        digits = fmt::format("{:X}", magnitude);
+                        break;
+                default:
+                        digits = fmt::format_int(magnitude).str();
+                        break;
+                }
+
+                /* a zero precision prints nothing for zero */
+                if(precision == 0 && magnitude == 0)
+                {
+                        digits.clear();
+                }
+
+                if(digits.size() < static_cast<std::size_t>(precision))
+                {
+                        digits.insert(0, static_cast<std::size_t>(precision) - digits.size(), '0');
+                }
+
+                if(conv.alternate && magnitude != 0 && (conv.type == 'x' || conv.type == 'X'))
+                {
+                        digits.insert(0, conv.type == 'x' ? "0x" : "0X");
+                }
+                else if(conv.alternate && conv.type == 'o' && (digits.empty() || digits[0] != '0'))
+                {
+                        digits.insert(0, "0");
+                }
+
+                if(negative)
+                {
+                        digits.insert(0, "-");
+                }
+                else if(conv.type == 'd' && conv.sign != '\0')
+                {
+                        digits.insert(digits.begin(), conv.sign);
+                }
+
+                return digits;
+        }
+
+        /* numeric arguments: decimal, octal with a leading 0, hex with a leading
+         * 0x, or the code of the character after a leading quote */
+        static std::int64_t to_integer(const std::string_view arg, State& state)
+        {
+                if(arg.empty())
+                {
+                        return 0;
+                }
+
+                if(arg.front() == '\'' || arg.front() == '"')
+                {
+                        return (arg.size() > 1) ? static_cast<unsigned char>(arg[1]) : 0;
+                }
+
+                const std::string str(arg);
+                char* end = nullptr;
+                errno = 0;
+                const std::int64_t value = std::strtoll(str.c_str(), &end, 0);
+                if(errno != 0 || end == str.c_str() || *end != '\0')
+                {
+                        print_err_fmt("shellter: printf: {}: invalid number\n", arg);
+                        state.ok = false;
+                }
+
+                return value;
+        }
+
+        static double to_double(const std::string_view arg, State& state)
+        {
+                if(arg.empty())
+                {
+                        return 0.0;
+                }
+
+                if(arg.front() == '\'' || arg.front() == '"')
+                {
+                        return (arg.size() > 1) ? static_cast<unsigned char>(arg[1]) : 0;
+                }
+
+                const std::string str(arg);
+                char* end = nullptr;
+                errno = 0;
+                const double value = std::strtod(str.c_str(), &end);
+                if(errno != 0 || end == str.c_str() || *end != '\0')
+                {
+                        print_err_fmt("shellter: printf: {}: invalid number\n", arg);
+                        state.ok = false;
+                }
+
+                return value;
+        }
+
+        /* handles the escape sequence at 'pos' and returns the position of its
+         * last character; %b arguments write octal escapes as \0NNN */
+        static std::size_t unescape(const std::string_view sv, std::size_t pos, std::string& out,
+                                    const bool argument)
+        {
+                if(pos + 1 >= sv.size())
+                {
+                        out.push_back('\\');
+                        return pos;
+                }
+
+                const char c = sv[++pos];
+                switch(c)
+                {
+                case 'a':
+                        out.push_back('\a');
+                        return pos;
+                case 'b':
+                        out.push_back('\b');
+                        return pos;
+                case 'e':
+                        out.push_back('\x1b');
+                        return pos;
+                case 'f':
+                        out.push_back('\f');
+                        return pos;
+                case 'n':
+                        out.push_back('\n');
+                        return pos;
+                case 'r':
+                        out.push_back('\r');
+                        return pos;
+                case 't':
+                        out.push_back('\t');
+                        return pos;
+                case 'v':
+                        out.push_back('\v');
+                        return pos;
+                case '\\':
+                case '"':
+                case '\'':
+                        out.push_back(c);
+                        return pos;
+                default:
+                        break;
+                }
+
+                const bool octal = (c >= '0' && c <= '7');
+                if(!octal && c != 'x')
+                {
+                        out.push_back('\\');
+                        out.push_back(c);
+                        return pos;
+                }
+
+                const int base = octal ? 8 : 16;
+                const std::size_t max_digits = octal ? 3 : 2;
+                std::size_t i = octal ? pos : pos + 1;
+                if(octal && argument && c == '0')
+                {
+                        ++i;
+                }
+
+                unsigned value = 0;
+                std::size_t digits = 0;
+                for(; i < sv.size() && digits < max_digits; ++i, ++digits)
+                {
+                        const char d = sv[i];
+                        const int digit = std::isdigit(static_cast<unsigned char>(d))
+                                              ? d - '0'
+                                              : (base == 16 && std::isxdigit(static_cast<unsigned char>(d)))
+                                                    ? std::tolower(static_cast<unsigned char>(d)) - 'a' + 10
+                                                    : base;
+                        if(digit >= base)
+                        {
+                                break;
+                        }
+                        value = value * static_cast<unsigned>(base) + static_cast<unsigned>(digit);
+                }
+
+                if(!octal && digits == 0)
+                {
+                        out.append("\\x");
+                        return pos;
+                }
+
+                out.push_back(static_cast<char>(value));
+                return i - 1;
+        }
+
+        std::vector<Segment> segments;
+};
@@ -0,0 +1,61 @@
+/* compiled regular expressions
+ *
+ * compiling a regex costs far more than matching it, and scripts tend to use
+ * the same few patterns over and over (in a loop, once per line); the last
+ * CACHE_SIZE patterns stay compiled, the least recently used one is dropped
+ * when a new one comes in */
+class RegexCache
+{
+public:
+        /* returns null, after printing a diagnostic, if 'pattern' isn't a valid
+         * regular expression; the result is valid until the next call */
+        static const boost::regex* get(const std::string_view pattern, const boost::regex::flag_type flags)
+        {
+                /* the flags are part of the key */
+                key.assign(reinterpret_cast<const char*>(&flags), sizeof(flags));
+                key.append(pattern);
+
+                const auto it = index.find(key);
+                if(it != index.end())
+                {
+                        entries.splice(entries.begin(), entries, it->second);
+                        return &entries.front().regex;
+                }
+
+                boost::regex regex(pattern.begin(), pattern.end(), flags | boost::regex::no_except);
+                if(regex.status() != 0)
+                {
+                        print_err_fmt("shellter: invalid regular expression: '{}'\n", pattern);
+                        return nullptr;
+                }
+
+                if(entries.size() == CACHE_SIZE)
+                {
+                        index.erase(entries.back().key);
+                        entries.pop_back();
+                }
+
+                entries.push_front({key, std::move(regex)});
+                index.emplace(key, entries.begin());
+
+                return &entries.front().regex;
+        }
+
+private:
+        static constexpr std::size_t CACHE_SIZE = 32;
+
+        struct Entry
+        {
+                std::string key;
+                boost::regex regex;
+        };
+
+        /* most recently used first */
+        static std::list<Entry> entries;
+        static string_map_t<std::list<Entry>::iterator> index;
+        static std::string key;
+};
+
+std::list<RegexCache::Entry> RegexCache::entries;
+string_map_t<std::list<RegexCache::Entry>::iterator> RegexCache::index;
+std::string RegexCache::key;
@@ -0,0 +1,334 @@
+/* 'shellter --server SOCKET [FILE]...': runs command lines sent over a Unix
+ * socket, so that starting the shell and sourcing FILEs is paid for once
+ *
+ * a client connects and sends a command line, then shuts down its side of the
+ * connection; with the first bytes it passes (SCM_RIGHTS) the three fds the
+ * command gets as stdin, stdout and stderr, so the output goes straight where
+ * the client wants it, as it's written. The server answers with the exit
+ * status in decimal and a newline. 'shellter --client SOCKET COMMANDS' is such
+ * a client, passing its own fds.
+ *
+ * the server keeps a pool of workers forked from the loaded shell, each waiting
+ * in accept(); a worker runs one command line, with the shell as it was after
+ * the FILEs were sourced, and ends. As soon as it takes a connection it tells
+ * the server, which forks the next one. Only the user running the server may
+ * connect */
+class CommandServer
+{
+public:
+        static int serve(const char* path, const std::span<char*> files)
+        {
+                for(char* file : files)
+                {
+                        const int status = builtins::source({"source", file});
+                        if(status != EXIT_SUCCESS)
+                        {
+                                return status;
+                        }
+                }
+
+                listen_fd = listen_at(path);
+                if(listen_fd < 0)
+                {
+                        return EXIT_FAILURE;
+                }
+
+                int notify_fds[2];
+                if(pipe2(notify_fds, O_CLOEXEC) < 0)
+                {
+                        print_err_fmt("shellter: --server: {}\n", strerror(errno));
+                        return EXIT_FAILURE;
+                }
+                notify_fd = notify_fds[1];
+
+                /* a command line in a worker must end with its status sent, not
+                 * with the worker exiting or being replaced */
+                embedded = true;
+                signal(SIGINT, SIG_DFL);
+
+                /* the server has no use for the status of a worker */
+                signal(SIGCHLD, SIG_IGN);
+
+                const std::size_t workers = std::max(2u, std::thread::hardware_concurrency());
+                for(std::size_t i = 0; i < workers; ++i)
+                {
+                        spawn_worker();
+                }
+
+                std::array<char, 64> taken;
+                while(true)
+                {
+                        const ssize_t n = read(notify_fds[0], taken.data(), taken.size());
+                        if(n < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if(n <= 0)
+                        {
+                                break;
+                        }
+
+                        for(ssize_t i = 0; i < n; ++i)
+                        {
+                                spawn_worker();
+                        }
+                }
+
+                return EXIT_FAILURE;
+        }
+
+        static int request(const char* path, const std::string_view commands)
+        {
+                const int fd = connect_to(path);
+                if(fd < 0)
+                {
+                        print_err_fmt("shellter: --client: {}: {}\n", path, strerror(errno));
+                        return EXIT_FAILURE;
+                }
+
+                /* the fds ride along with the first bytes, so there must be some */
+                std::string line(commands);
+                line += '\n';
+
+                iovec iov = {line.data(), line.size()};
+                alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * 3)> control = {};
+                msghdr msg = {};
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control.data();
+                msg.msg_controllen = control.size();
+
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+                const std::array<int, 3> std_fds = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+                std::memcpy(CMSG_DATA(cmsg), std_fds.data(), sizeof(int) * 3);
+
+                ssize_t sent;
+                while((sent = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+                {
+                }
+
+                std::string_view rest = line;
+                rest.remove_prefix((sent > 0) ? static_cast<std::size_t>(sent) : rest.size());
+                while(sent > 0 && !rest.empty())
+                {
+                        sent = send(fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+                        if(sent > 0)
+                        {
+                                rest.remove_prefix(static_cast<std::size_t>(sent));
+                        }
+                        else if(errno == EINTR)
+                        {
+                                sent = 1;
+                        }
+                }
+                shutdown(fd, SHUT_WR);
+
+                std::string answer;
+                std::array<char, 16> buf;
+                ssize_t n;
+                while((n = read(fd, buf.data(), buf.size())) > 0 || (n < 0 && errno == EINTR))
+                {
+                        answer.append(buf.data(), static_cast<std::size_t>(std::max<ssize_t>(n, 0)));
+                }
+                close(fd);
+
+                int status;
+                const auto [end, ec] = std::from_chars(answer.data(), answer.data() + answer.size(), status);
+                if(ec != std::errc() || end == answer.data() || *end != '\n')
+                {
+                        print_err_fmt("shellter: --client: {}: the server closed the connection\n", path);
+                        return EXIT_FAILURE;
+                }
+
+                return status;
+        }
+
+private:
+        static int listen_at(const char* path)
+        {
+                sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                if(std::strlen(path) >= sizeof(addr.sun_path))
+                {
+                        print_err_fmt("shellter: --server: {}: socket path too long\n", path);
+                        return -1;
+                }
+                std::strcpy(addr.sun_path, path);
+
+                /* a socket left by a server that's gone is replaced, a live one
+                 * isn't */
+                struct stat st;
+                if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+                {
+                        const int probe = connect_to(path);
+                        if(probe >= 0)
+                        {
+                                close(probe);
+                                print_err_fmt("shellter: --server: {}: a server is already listening\n", path);
+                                return -1;
+                        }
+
+                        unlink(path);
+                }
+
+                const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                const mode_t mask = umask(077);
+                const bool bound = fd >= 0 && bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+                umask(mask);
+
+                if(!bound || listen(fd, SOMAXCONN) < 0)
+                {
+                        print_err_fmt("shellter: --server: {}: {}\n", path, strerror(errno));
+                        if(fd >= 0)
+                        {
+                                close(fd);
+                        }
+                        return -1;
+                }
+
+                return move_fd_high(fd);
+        }
+
+        static int connect_to(const char* path)
+        {
+                sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                if(std::strlen(path) >= sizeof(addr.sun_path))
+                {
+                        errno = ENAMETOOLONG;
+                        return -1;
+                }
+                std::strcpy(addr.sun_path, path);
+
+                const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+                {
+                        const int saved_errno = errno;
+                        close(fd);
+                        errno = saved_errno;
+                        return -1;
+                }
+
+                return fd;
+        }
+
+        static void spawn_worker()
+        {
+                const pid_t pid = fork();
+                if(pid < 0)
+                {
+                        print_err_fmt("shellter: --server: fork: {}\n", strerror(errno));
+                }
+                if(pid != 0)
+                {
+                        return;
+                }
+
+                /* a worker waits for its commands */
+                signal(SIGCHLD, SIG_DFL);
+
+                /* idle workers go with the server; busy ones finish their command */
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+                if(getppid() == 1)
+                {
+                        _exit(EXIT_FAILURE);
+                }
+
+                int conn;
+                while(true)
+                {
+                        conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                        if(conn >= 0 || (errno != EINTR && errno != ECONNABORTED))
+                        {
+                                break;
+                        }
+                }
+
+                const char taken = 1;
+                write(notify_fd, &taken, 1);
+                prctl(PR_SET_PDEATHSIG, 0);
+                close(listen_fd);
+                close(notify_fd);
+
+                exit_child((conn >= 0) ? serve_connection(move_fd_high(conn)) : EXIT_FAILURE);
+        }
+
+        static int serve_connection(const int conn)
+        {
+                ucred peer;
+                socklen_t peer_len = sizeof(peer);
+                if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) < 0 || peer.uid != geteuid())
+                {
+                        return EXIT_FAILURE;
+                }
+
+                std::string commands;
+                std::array<char, 4096> buf;
+                iovec iov = {buf.data(), buf.size()};
+                alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * 3)> control = {};
+                msghdr msg = {};
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control.data();
+                msg.msg_controllen = control.size();
+
+                ssize_t n;
+                while((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+                {
+                }
+
+                std::vector<int> fds;
+                for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+                {
+                        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                        {
+                                fds.resize((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                                std::memcpy(fds.data(), CMSG_DATA(cmsg), fds.size() * sizeof(int));
+                        }
+                }
+
+                while(n > 0)
+                {
+                        commands.append(buf.data(), static_cast<std::size_t>(n));
+                        while((n = read(conn, buf.data(), buf.size())) < 0 && errno == EINTR)
+                        {
+                        }
+                }
+
+                int status = 2;
+                if(fds.size() == 3 && n == 0 && (msg.msg_flags & MSG_CTRUNC) == 0)
+                {
+                        /* out of the way first: one may have come as 0, 1 or 2 */
+                        for(int& fd : fds)
+                        {
+                                fd = move_fd_high(fd);
+                        }
+
+                        for(int fd = 0; fd < 3; ++fd)
+                        {
+                                dup2(fds[fd], fd);
+                                close(fds[fd]);
+                        }
+
+                        status = run_source(commands);
+                }
+                else if(!commands.empty() || !fds.empty())
+                {
+                        print_err_fmt("shellter: --server: a request must come with stdin, stdout and stderr\n");
+                }
+
+                const auto answer = fmt::format("{}\n", status);
+                send(conn, answer.data(), answer.size(), MSG_NOSIGNAL);
+
+                return EXIT_SUCCESS;
+        }
+
+        static int listen_fd;
+        static int notify_fd;
+};
+
+int CommandServer::listen_fd = -1;
+int CommandServer::notify_fd = -1;
@@ -0,0 +1,100 @@
+/* libshellter: runs shell code inside another program, without /bin/sh
+ *
+ *     shellter::Shell sh;
+ *     std::string out;
+ *     const int status = sh.run("basename /srv/data/report.csv .csv", &out);
+ *
+ * every Shell has variables, functions, aliases, options, a working directory
+ * and a umask of its own, and starts with the environment of the process.
+ * Shells take turns: run() holds a lock for the whole process, and while it
+ * runs the working directory, the umask and fds 0-9 of the process are the
+ * shell's; all of them are put back when it returns. 'exit' and 'exec' end
+ * the script, never the process. run() must not be called from inside a run.
+ *
+ * Executor runs commands in the background, many at a time (see below).
+ *
+ * built with 'make libshellter.a'; link with
+ *     -lshellter -lboost_regex -lreadline -pthread -ldl */
+#ifndef SHELLTER_H
+#define SHELLTER_H
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+
+namespace shellter
+{
+
+class Shell
+{
+public:
+        Shell();
+        ~Shell();
+
+        Shell(Shell&&) noexcept;
+        Shell& operator=(Shell&&) noexcept;
+
+        Shell(const Shell&) = delete;
+        Shell& operator=(const Shell&) = delete;
+
+        /* runs 'script' and returns its exit status; what it writes to stdout
+         * and stderr is stored in 'out' and 'err' when they're given (the same
+         * string for both keeps them interleaved), and goes to the fds of the
+         * process otherwise */
+        int run(std::string_view script, std::string* out = nullptr, std::string* err = nullptr);
+
+        struct State; /* defined by the library */
+
+private:
+        friend class Executor;
+
+        std::unique_ptr<State> state;
+};
+
+/* how a command submitted to an Executor ended */
+struct Result
+{
+        int status = 0;      /* like $?: 128 + N when killed by signal N */
+        struct rusage usage = {}; /* of the command and everything it waited for */
+        std::string out;
+        std::string err;
+};
+
+/* runs command lines asynchronously, from any number of threads at once
+ *
+ * each command runs in a process of its own, forked from the submitting
+ * thread with the state of shell() at that moment, so commands don't wait for
+ * one another; its stdin is /dev/null and its output is captured. A single
+ * reaper thread collects the commands as they end and delivers the results:
+ * callbacks run on that thread, and should be quick.
+ *
+ * children are waited for by pid: the program must not reap them itself
+ * (wait(-1), SIGCHLD set to SIG_IGN). The destructor waits for every command
+ * already submitted. */
+class Executor
+{
+public:
+        Executor();
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        /* the shell commands start from: its variables, functions, directory... */
+        Shell& shell();
+
+        std::future<Result> submit(std::string_view script);
+        void submit(std::string_view script, std::function<void(Result)> done);
+
+        struct Impl; /* defined by the library */
+
+private:
+        std::unique_ptr<Impl> impl;
+};
+
+} // namespace shellter
+
+#endif
@@ -0,0 +1,64 @@
+/* loadable builtins: the interface between shellter and the shared objects
+ * loaded with 'enable -f FILE NAME...'
+ *
+ * for each NAME, the object exports a 'struct shellter_builtin' called
+ * 'shellter_builtin_NAME'. The builtin runs in the shell process, with the
+ * redirections of its command already applied to the fds in its context, so it
+ * costs no fork; what it returns is its exit status.
+ *
+ *     #include "shellter_plugin.h"
+ *
+ *     static int hello(int argc, char** argv, const struct shellter_context* ctx)
+ *     {
+ *             dprintf(ctx->out_fd, "hello, %s\n", argc > 1 ? argv[1] : "world");
+ *             return 0;
+ *     }
+ *
+ *     const struct shellter_builtin shellter_builtin_hello = {
+ *             SHELLTER_PLUGIN_ABI, hello, "hello [NAME]"
+ *     };
+ *
+ * and built with 'cc -shared -fPIC hello.c -o hello.so'.
+ *
+ * the interface only ever grows: new members go at the end of the structs and
+ * come with a new ABI version, so objects built against an older version keep
+ * working */
+#ifndef SHELLTER_PLUGIN_H
+#define SHELLTER_PLUGIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHELLTER_PLUGIN_ABI 1
+
+struct shellter_context
+{
+        unsigned int abi; /* the version the shell implements */
+
+        int in_fd;
+        int out_fd;
+        int err_fd;
+
+        /* the value of a shell variable, or null if it isn't set; valid until
+         * the builtin calls into the shell again or returns */
+        const char* (*get_var)(const char* name);
+
+        /* assigns a shell variable; returns 0, or -1 if 'name' isn't valid */
+        int (*set_var)(const char* name, const char* value);
+};
+
+typedef int (*shellter_builtin_func)(int argc, char** argv, const struct shellter_context* ctx);
+
+struct shellter_builtin
+{
+        unsigned int abi; /* SHELLTER_PLUGIN_ABI, as seen when the object was built */
+        shellter_builtin_func func;
+        const char* usage; /* may be null */
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
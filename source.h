@@ -0,0 +1,529 @@
+/* sourced scripts
+ *
+ * the compiled form of every sourced file is kept on disk, in
+ * $XDG_CACHE_HOME/shellter (~/.cache/shellter by default), under the hash of
+ * the file's real path. An entry is used while the file keeps its mtime and
+ * size and the entry was written by the same build of the shell; it's then
+ * mapped into memory and turned back into a program, without parsing the
+ * script again */
+class ScriptCache
+{
+public:
+        /* compiles the script at 'path' into 'program', or takes it from the
+         * cache; like a command, fails with 1 if the file can't be read and with
+         * 2 if it has syntax errors */
+        static int load(const std::string& path, Program& program)
+        {
+                const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if(fd < 0)
+                {
+                        print_err_fmt("shellter: source: {}: {}\n", path, strerror(errno));
+                        return EXIT_FAILURE;
+                }
+
+                struct stat st;
+                if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+                {
+                        print_err_fmt("shellter: source: {}: not a regular file\n", path);
+                        close(fd);
+                        return EXIT_FAILURE;
+                }
+
+                std::error_code ec;
+                const auto real_path = fs::canonical(path, ec);
+
+                const Key key = {st.st_mtim.tv_sec, st.st_mtim.tv_nsec, static_cast<std::uint64_t>(st.st_size)};
+
+                /* aliases are expanded while parsing, so a script compiled with
+                 * some defined doesn't stand for the file alone */
+                const auto entry = (Aliases::empty() && !ec) ? entry_path(real_path.native()) : std::nullopt;
+                if(entry.has_value() && read_entry(*entry, real_path.native(), key, program))
+                {
+                        close(fd);
+                        return EXIT_SUCCESS;
+                }
+
+                std::string source;
+                const bool read_ok = read_file(fd, source);
+                close(fd);
+                if(!read_ok)
+                {
+                        print_err_fmt("shellter: source: {}: {}\n", path, strerror(errno));
+                        return EXIT_FAILURE;
+                }
+
+                list_t tree;
+                const auto status = Parser::parse(source, tree);
+                if(status == Parser::Status::INCOMPLETE)
+                {
+                        print_err_fmt("shellter: {}: syntax error: unexpected end of file\n", path);
+                }
+
+                if(status != Parser::Status::OK || !Compiler::compile(tree, program))
+                {
+                        return 2;
+                }
+
+                if(entry.has_value())
+                {
+                        write_entry(*entry, real_path.native(), key, program);
+                }
+
+                return EXIT_SUCCESS;
+        }
+
+private:
+        /* what makes an entry stale; the build stamps a new shell */
+        struct Key
+        {
+                std::int64_t mtime_sec;
+                std::int64_t mtime_nsec;
+                std::uint64_t size;
+        };
+
+        struct Header
+        {
+                std::array<char, 8> magic;
+                std::array<char, 24> build;
+                Key key;
+                std::uint32_t path_size; /* the path follows, then the program */
+        };
+
+        static constexpr std::array<char, 8> MAGIC = {'s', 'h', 't', 'r', 'c', 0, 0, 1};
+
+        static std::array<char, 24> build_id()
+        {
+                std::array<char, 24> id = {};
+                constexpr std::string_view stamp = __DATE__ " " __TIME__;
+                std::copy_n(stamp.begin(), std::min(stamp.size(), id.size()), id.begin());
+
+                return id;
+        }
+
+        static std::optional<std::string> entry_path(const std::string_view real_path)
+        {
+                const auto* cache_var = shell_vars.find("XDG_CACHE_HOME");
+                const auto* home_var = shell_vars.find("HOME");
+
+                fs::path dir;
+                if(cache_var != nullptr && !cache_var->value.empty())
+                {
+                        dir = fs::path(cache_var->value) / "shellter";
+                }
+                else if(home_var != nullptr && !home_var->value.empty())
+                {
+                        dir = fs::path(home_var->value) / ".cache" / "shellter";
+                }
+                else
+                {
+                        return std::nullopt;
+                }
+
+                return fmt::format("{}/{:016x}.shc", dir.native(), std::hash<std::string_view>{}(real_path));
+        }
+
+        static bool read_file(const int fd, std::string& out)
+        {
+                std::array<char, 64 * 1024> buf;
+                while(true)
+                {
+                        const ssize_t n = read(fd, buf.data(), buf.size());
+                        if(n < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if(n <= 0)
+                        {
+                                return n == 0;
+                        }
+
+                        out.append(buf.data(), static_cast<std::size_t>(n));
+                }
+        }
+
+        /* entries aren't trusted: one that is short, has counts beyond its size,
+         * nests too deep or has operands outside the program is simply not used */
+        class Reader
+        {
+        public:
+                explicit Reader(const std::string_view data)
+                    : data(data)
+                {
+                }
+
+                template<typename T>
+                bool get(T& value)
+                {
+                        if(data.size() < sizeof(T))
+                        {
+                                return false;
+                        }
+
+                        std::memcpy(&value, data.data(), sizeof(T));
+                        data.remove_prefix(sizeof(T));
+                        return true;
+                }
+
+                bool get(std::string_view& sv, const std::size_t size)
+                {
+                        if(data.size() < size)
+                        {
+                                return false;
+                        }
+
+                        sv = data.substr(0, size);
+                        data.remove_prefix(size);
+                        return true;
+                }
+
+                bool done() const
+                {
+                        return data.empty();
+                }
+
+                /* whether 'count' records of at least 'size' bytes each may follow */
+                bool fits(const std::uint32_t count, const std::size_t size) const
+                {
+                        return count <= data.size() / size;
+                }
+
+        private:
+                std::string_view data;
+        };
+
+        static bool read_entry(const std::string& entry, const std::string_view real_path, const Key& key,
+                               Program& program)
+        {
+                const int fd = open(entry.c_str(), O_RDONLY | O_CLOEXEC);
+                if(fd < 0)
+                {
+                        return false;
+                }
+
+                struct stat st;
+                void* map = MAP_FAILED;
+                if(fstat(fd, &st) == 0 && st.st_size > 0)
+                {
+                        map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                }
+                close(fd);
+
+                if(map == MAP_FAILED)
+                {
+                        return false;
+                }
+
+                Reader reader({static_cast<const char*>(map), static_cast<std::size_t>(st.st_size)});
+
+                Header header;
+                std::string_view path;
+                const bool valid = reader.get(header) && header.magic == MAGIC && header.build == build_id() &&
+                                   header.key.mtime_sec == key.mtime_sec && header.key.mtime_nsec == key.mtime_nsec &&
+                                   header.key.size == key.size && reader.get(path, header.path_size) &&
+                                   path == real_path && read_program(reader, program) && reader.done();
+
+                munmap(map, static_cast<std::size_t>(st.st_size));
+                if(!valid)
+                {
+                        program = Program();
+                }
+
+                return valid;
+        }
+
+        /* the smallest records: an instruction, a string and a program */
+        static constexpr std::size_t INSTR_SIZE = 3 * sizeof(std::uint32_t);
+        static constexpr std::size_t STRING_SIZE = sizeof(std::uint32_t);
+        static constexpr std::size_t PROGRAM_SIZE = 3 * sizeof(std::uint32_t);
+
+        /* functions defined in functions, as deep as an entry may go */
+        static constexpr int NESTING_LIMIT = 32;
+
+        static bool read_program(Reader& reader, Program& program, const int depth = 0)
+        {
+                std::uint32_t count;
+                if(depth > NESTING_LIMIT || !reader.get(count) || !reader.fits(count, INSTR_SIZE))
+                {
+                        return false;
+                }
+
+                program.code.resize(count);
+                for(auto& instr : program.code)
+                {
+                        std::uint32_t op;
+                        if(!reader.get(op) || op > static_cast<std::uint32_t>(Program::Op::CONDITIONAL) ||
+                           !reader.get(instr.a) || !reader.get(instr.b))
+                        {
+                                return false;
+                        }
+
+                        instr.op = static_cast<Program::Op>(op);
+                }
+
+                if(!reader.get(count) || !reader.fits(count, STRING_SIZE))
+                {
+                        return false;
+                }
+
+                program.strings.resize(count);
+                for(auto& str : program.strings)
+                {
+                        std::uint32_t size;
+                        std::string_view sv;
+                        if(!reader.get(size) || !reader.get(sv, size))
+                        {
+                                return false;
+                        }
+
+                        str.assign(sv);
+                }
+
+                if(!reader.get(count) || !reader.fits(count, PROGRAM_SIZE))
+                {
+                        return false;
+                }
+
+                for(std::uint32_t i = 0; i < count; ++i)
+                {
+                        auto function = std::make_shared<Program>();
+                        if(!read_program(reader, *function, depth + 1))
+                        {
+                                return false;
+                        }
+
+                        program.functions.push_back(std::move(function));
+                }
+
+                return valid_operands(program);
+        }
+
+        /* every operand the interpreter uses as an index must be in range */
+        static bool valid_operands(const Program& program)
+        {
+                using Op = Program::Op;
+
+                const std::uint64_t code_size = program.code.size();
+                const std::uint64_t strings_size = program.strings.size();
+
+                const auto words = [&](const Program::Instr& instr)
+                {
+                        return std::uint64_t{instr.a} + instr.b <= strings_size;
+                };
+
+                for(std::uint64_t pos = 0; pos < code_size; ++pos)
+                {
+                        const Program::Instr& instr = program.code[pos];
+
+                        bool ok = true;
+                        switch(instr.op)
+                        {
+                        case Op::RUN:
+                        case Op::FOR_BEGIN:
+                        case Op::REDIRECT:
+                        case Op::CONDITIONAL:
+                                ok = words(instr);
+                                break;
+                        case Op::PIPELINE:
+                                /* the stage table follows */
+                                ok = instr.a != 0 && pos + instr.a < code_size &&
+                                     (instr.b == Program::NONE || instr.b < strings_size);
+                                for(std::uint64_t i = 1; ok && i <= instr.a; ++i)
+                                {
+                                        ok = program.code[pos + i].op == Op::STAGE;
+                                }
+                                break;
+                        case Op::STAGE:
+                                ok = instr.a <= instr.b && instr.b <= code_size;
+                                break;
+                        case Op::JUMP:
+                        case Op::JUMP_IF_FAILURE:
+                        case Op::JUMP_IF_SUCCESS:
+                                ok = instr.a <= code_size;
+                                break;
+                        case Op::FOR_NEXT:
+                        case Op::CASE_MATCH:
+                                ok = instr.a < strings_size && instr.b <= code_size;
+                                break;
+                        case Op::CASE_BEGIN:
+                                ok = instr.a < strings_size;
+                                break;
+                        case Op::DEFINE:
+                                ok = instr.a < strings_size && instr.b < program.functions.size();
+                                break;
+                        case Op::SUBSHELL:
+                                ok = instr.a <= code_size &&
+                                     (instr.b == Program::FORK || instr.b == Program::IN_PROCESS);
+                                break;
+                        case Op::NEGATE:
+                        case Op::SET_STATUS:
+                        case Op::FOR_END:
+                        case Op::UNREDIRECT:
+                                break;
+                        }
+
+                        if(!ok)
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        static void put(std::string& out, const std::uint32_t value)
+        {
+                out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        static void write_program(std::string& out, const Program& program)
+        {
+                put(out, static_cast<std::uint32_t>(program.code.size()));
+                for(const auto& instr : program.code)
+                {
+                        put(out, static_cast<std::uint32_t>(instr.op));
+                        put(out, instr.a);
+                        put(out, instr.b);
+                }
+
+                put(out, static_cast<std::uint32_t>(program.strings.size()));
+                for(const auto& str : program.strings)
+                {
+                        put(out, static_cast<std::uint32_t>(str.size()));
+                        out.append(str);
+                }
+
+                put(out, static_cast<std::uint32_t>(program.functions.size()));
+                for(const auto& function : program.functions)
+                {
+                        write_program(out, *function);
+                }
+        }
+
+        /* written next to the entry and renamed over it, so that a reader never
+         * sees half of one; failing to write it only costs the next parse */
+        static void write_entry(const std::string& entry, const std::string_view real_path, const Key& key,
+                                const Program& program)
+        {
+                std::error_code ec;
+                fs::create_directories(fs::path(entry).parent_path(), ec);
+                if(ec)
+                {
+                        return;
+                }
+
+                Header header = {};
+                header.magic = MAGIC;
+                header.build = build_id();
+                header.key = key;
+                header.path_size = static_cast<std::uint32_t>(real_path.size());
+
+                std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+                data.append(real_path);
+                write_program(data, program);
+
+                const auto tmp = fmt::format("{}.{}", entry, getpid());
+                const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if(fd < 0)
+                {
+                        return;
+                }
+
+                bool written;
+                {
+                        FdWriter out(fd);
+                        out.append(data);
+                        written = out.flush();
+                }
+                close(fd);
+
+                if(!written || rename(tmp.c_str(), entry.c_str()) < 0)
+                {
+                        unlink(tmp.c_str());
+                }
+        }
+};
+
+namespace builtins
+{
+
+/* a name without a slash is looked up in PATH, then in the current directory */
+static std::string find_sourced(const std::string& name)
+{
+        if(name.find('/') != name.npos)
+        {
+                return name;
+        }
+
+        const auto* path_var = shell_vars.find("PATH");
+        std::string_view path = (path_var != nullptr) ? std::string_view(path_var->value) : "";
+
+        std::string candidate;
+        while(!path.empty())
+        {
+                const auto colon_pos = path.find(':');
+                const auto dir = path.substr(0, colon_pos);
+                path = (colon_pos != path.npos) ? path.substr(colon_pos + 1) : "";
+
+                candidate.assign(dir.empty() ? "." : dir);
+                candidate += '/';
+                candidate += name;
+
+                struct stat st;
+                if(stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), R_OK) == 0)
+                {
+                        return candidate;
+                }
+        }
+
+        return name;
+}
+
+int source(const args_t& args)
+{
+        static constexpr std::size_t MAX_DEPTH = 100;
+
+        const std::size_t len = args.size();
+        if(len < 2)
+        {
+                print_err_fmt("shellter: {} usage: {} FILE [ARG]...\n", args[0], args[0]);
+                return 2;
+        }
+
+        if(source_depth == MAX_DEPTH)
+        {
+                print_err_fmt("shellter: {}: maximum source nesting level exceeded ({})\n", args[1], MAX_DEPTH);
+                return EXIT_FAILURE;
+        }
+
+        Program program;
+        const int load_status = ScriptCache::load(find_sourced(args[1]), program);
+        if(load_status != EXIT_SUCCESS)
+        {
+                return load_status;
+        }
+
+        /* the arguments, if any, replace $1, $2, ... while the script runs */
+        std::vector<std::string> params;
+        if(len > 2)
+        {
+                params.reserve(len - 1);
+                params.push_back(positional_params[0]);
+                params.insert(params.end(), args.begin() + 2, args.end());
+                std::swap(params, positional_params);
+        }
+
+        ++source_depth;
+        const int status = Interpreter::run(program);
+        --source_depth;
+
+        /* a 'return' at the top of the script ends the script */
+        function_returning = false;
+        if(len > 2)
+        {
+                std::swap(params, positional_params);
+        }
+
+        return status;
+}
+
+} // namespace builtins
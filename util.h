@@ -14,3 +14,214 @@ auto sv_from_match(const auto& boost_rmatch_result)
 {
         return std::string_view(boost_rmatch_result.first, boost_rmatch_result.second);
 }
+
+/* parses sizes such as '4096', '64K', '1M' or '2G' */
+std::optional<std::size_t> parse_size(const std::string_view sv)
+{
+        std::size_t value = 0;
+        const auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+        if(ec != std::errc() || ptr == sv.data())
+        {
+                return std::nullopt;
+        }
+
+        const std::string_view suffix(ptr, sv.data() + sv.size());
+        if(suffix.empty())
+        {
+                return value;
+        }
+
+        if(suffix.size() != 1)
+        {
+                return std::nullopt;
+        }
+
+        unsigned shift;
+        switch(suffix[0])
+        {
+        case 'k':
+        case 'K':
+                shift = 10;
+                break;
+        case 'm':
+        case 'M':
+                shift = 20;
+                break;
+        case 'g':
+        case 'G':
+                shift = 30;
+                break;
+        default:
+                return std::nullopt;
+        }
+
+        std::size_t scaled;
+        if(__builtin_mul_overflow(value, std::size_t{1} << shift, &scaled))
+        {
+                return std::nullopt;
+        }
+
+        return scaled;
+}
+
+/* output buffer bound to a file descriptor; the data is written with as few
+ * write()/writev() calls as possible, bypassing the stdio buffers */
+class FdWriter
+{
+public:
+        explicit FdWriter(const int fd)
+            : fd(fd)
+        {
+        }
+
+        FdWriter(const FdWriter&) = delete;
+        FdWriter& operator=(const FdWriter&) = delete;
+
+        ~FdWriter()
+        {
+                flush();
+        }
+
+        void append(const std::string_view sv)
+        {
+                if(buf.size() + sv.size() <= CAPACITY)
+                {
+                        buf.append(sv);
+                        return;
+                }
+
+                /* what doesn't fit is written along with the buffer, without copying */
+                std::array<iovec, 2> iov = {{
+                    {buf.data(), buf.size()},
+                    {const_cast<char*>(sv.data()), sv.size()}
+                }};
+                write_all(iov.data(), static_cast<int>(iov.size()));
+                buf.clear();
+        }
+
+        void append(const char c)
+        {
+                if(buf.size() == CAPACITY)
+                {
+                        flush();
+                }
+
+                buf.push_back(c);
+        }
+
+        template<typename... Args>
+        void print(fmt::format_string<Args...> fmt_str, Args&&... args)
+        {
+                fmt::format_to(std::back_inserter(buf), fmt_str, std::forward<Args>(args)...);
+                if(buf.size() >= CAPACITY)
+                {
+                        flush();
+                }
+        }
+
+        /* returns false if any write failed since the writer was created */
+        bool flush()
+        {
+                if(buf.size() != 0)
+                {
+                        iovec iov = {buf.data(), buf.size()};
+                        write_all(&iov, 1);
+                        buf.clear();
+                }
+
+                return !failed;
+        }
+
+private:
+        static constexpr std::size_t CAPACITY = 64 * 1024;
+
+        void write_all(iovec* iov, int iovcnt)
+        {
+                while(iovcnt > 0 && !failed)
+                {
+                        const ssize_t written = writev(fd, iov, iovcnt);
+                        if(written < 0)
+                        {
+                                if(errno == EINTR)
+                                {
+                                        continue;
+                                }
+
+                                print_err_fmt("shellter: write error: {}\n", strerror(errno));
+                                failed = true;
+                                return;
+                        }
+
+                        /* skip what was written, resume after a partial write */
+                        auto left = static_cast<std::size_t>(written);
+                        while(iovcnt > 0 && left >= iov->iov_len)
+                        {
+                                left -= iov->iov_len;
+                                ++iov;
+                                --iovcnt;
+                        }
+
+                        if(iovcnt > 0)
+                        {
+                                iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                                iov->iov_len -= left;
+                        }
+                }
+        }
+
+        int fd;
+        bool failed = false;
+        fmt::memory_buffer buf;
+};
+
+/* checks for a valid variable name: [A-Za-z_][A-Za-z0-9_]* */
+bool is_valid_name(const std::string_view sv)
+{
+        if(sv.empty() || std::isdigit(static_cast<unsigned char>(sv.front())))
+        {
+                return false;
+        }
+
+        return std::all_of(sv.begin(), sv.end(),
+                           [](const char c)
+                           {
+                                   return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+                           });
+}
+
+/* array variable; the elements are stored back to back in a single arena */
+struct ShellArray
+{
+        std::string arena;
+        std::vector<std::size_t> offsets = {0}; /* element i is [offsets[i], offsets[i + 1]) */
+
+        std::size_t size() const
+        {
+                return offsets.size() - 1;
+        }
+
+        std::string_view operator[](const std::size_t i) const
+        {
+                return std::string_view(arena).substr(offsets[i], offsets[i + 1] - offsets[i]);
+        }
+
+        void push_back(const std::string_view sv)
+        {
+                arena.append(sv);
+                offsets.push_back(arena.size());
+        }
+};
+
+/* hash allowing lookups with string_views, without building a std::string */
+struct StringHash
+{
+        using is_transparent = void;
+
+        std::size_t operator()(const std::string_view sv) const
+        {
+                return std::hash<std::string_view>{}(sv);
+        }
+};
+
+template<typename T>
+using string_map_t = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
@@ -0,0 +1,291 @@
+/* shell variables
+ *
+ * scalars and arrays live in one store made of scope frames; lookups go from
+ * the innermost frame outwards. Exported variables form the environment of the
+ * commands the shell runs: the envp array passed to execve() is cached and only
+ * rebuilt after an exported variable changed */
+class VariableStore
+{
+public:
+        struct Variable
+        {
+                std::string value;
+                std::unique_ptr<ShellArray> array; /* null for scalars */
+                bool exported = false;
+        };
+
+        VariableStore()
+            : frames(1)
+        {
+        }
+
+        const Variable* find(const std::string_view name) const
+        {
+                for(auto it = frames.rbegin(); it != frames.rend(); ++it)
+                {
+                        const auto var_it = it->find(name);
+                        if(var_it != it->end())
+                        {
+                                return &var_it->second;
+                        }
+                }
+
+                return nullptr;
+        }
+
+        /* assigns to the innermost variable called 'name', creating a global one if
+         * there's none; the export flag is kept */
+        void set(const std::string_view name, std::string value)
+        {
+                Variable& var = lookup_or_create(name);
+                var.value = std::move(value);
+                var.array.reset();
+                changed(var);
+        }
+
+        void set_array(const std::string_view name, ShellArray array)
+        {
+                Variable& var = lookup_or_create(name);
+                var.value.clear();
+                var.array = std::make_unique<ShellArray>(std::move(array));
+                changed(var);
+        }
+
+        /* creates 'name' in the innermost frame, shadowing outer variables; as in
+         * other shells, a local copy of an exported variable is exported too */
+        void set_local(const std::string_view name, std::string value)
+        {
+                auto& frame = frames.back();
+                auto it = frame.find(name);
+                if(it == frame.end())
+                {
+                        const Variable* outer = find(name);
+                        const bool exported = (outer != nullptr && outer->exported);
+
+                        it = frame.emplace(std::string(name), Variable{}).first;
+                        it->second.exported = exported;
+                }
+
+                it->second.value = std::move(value);
+                it->second.array.reset();
+                changed(it->second);
+        }
+
+        void set_exported(const std::string_view name, const bool exported)
+        {
+                Variable& var = lookup_or_create(name);
+                if(var.exported != exported)
+                {
+                        var.exported = exported;
+                        ++env_generation;
+                }
+
+                ++generation;
+        }
+
+        void unset(const std::string_view name)
+        {
+                for(auto it = frames.rbegin(); it != frames.rend(); ++it)
+                {
+                        const auto var_it = it->find(name);
+                        if(var_it != it->end())
+                        {
+                                if(var_it->second.exported)
+                                {
+                                        ++env_generation;
+                                }
+
+                                it->erase(var_it);
+                                ++generation;
+                                return;
+                        }
+                }
+        }
+
+        void push_scope()
+        {
+                frames.emplace_back();
+        }
+
+        void pop_scope()
+        {
+                if(frames.size() == 1)
+                {
+                        return;
+                }
+
+                /* the environment changes if a popped variable was in it or hid
+                 * one that was */
+                for(const auto& [name, var] : frames.back())
+                {
+                        if(var.exported || shadows_exported(name))
+                        {
+                                ++env_generation;
+                                break;
+                        }
+                }
+
+                frames.pop_back();
+                ++generation;
+        }
+
+        /* a copy of all the variables, for subshells that run in the shell process */
+        VariableStore snapshot() const
+        {
+                VariableStore copy;
+                copy.frames.clear();
+                copy.frames.reserve(frames.size());
+
+                for(const auto& frame : frames)
+                {
+                        auto& frame_copy = copy.frames.emplace_back();
+                        frame_copy.reserve(frame.size());
+                        for(const auto& [name, var] : frame)
+                        {
+                                frame_copy.emplace(name, Variable{var.value,
+                                                                  var.array ? std::make_unique<ShellArray>(*var.array)
+                                                                            : nullptr,
+                                                                  var.exported});
+                        }
+                }
+
+                return copy;
+        }
+
+        /* puts back the variables of a snapshot; the generation keeps growing, so
+         * nothing cached for the state in between is taken as current */
+        void restore(VariableStore&& saved)
+        {
+                frames = std::move(saved.frames);
+                generation = std::max(generation, saved.generation) + 1;
+                ++env_generation;
+        }
+
+        /* bumped on every change */
+        std::uint64_t get_generation() const
+        {
+                return generation;
+        }
+
+        /* null terminated "NAME=value" array of the exported variables */
+        char* const* envp()
+        {
+                if(envp_generation != env_generation)
+                {
+                        build_envp();
+                }
+
+                return env_ptrs.data();
+        }
+
+private:
+        using frame_t = string_map_t<Variable>;
+
+        Variable& lookup_or_create(const std::string_view name)
+        {
+                for(auto it = frames.rbegin(); it != frames.rend(); ++it)
+                {
+                        const auto var_it = it->find(name);
+                        if(var_it != it->end())
+                        {
+                                return var_it->second;
+                        }
+                }
+
+                return frames.front().emplace(std::string(name), Variable{}).first->second;
+        }
+
+        /* whether the variable 'name' in the innermost frame hides an exported one */
+        bool shadows_exported(const std::string_view name) const
+        {
+                for(auto it = std::next(frames.rbegin()); it != frames.rend(); ++it)
+                {
+                        const auto var_it = it->find(name);
+                        if(var_it != it->end())
+                        {
+                                return var_it->second.exported;
+                        }
+                }
+
+                return false;
+        }
+
+        void changed(const Variable& var)
+        {
+                ++generation;
+                if(var.exported)
+                {
+                        ++env_generation;
+                }
+        }
+
+        void build_envp()
+        {
+                /* inner frames shadow outer ones */
+                std::vector<std::pair<std::string_view, const Variable*>> visible;
+                string_map_t<bool> seen;
+                for(auto it = frames.rbegin(); it != frames.rend(); ++it)
+                {
+                        for(const auto& [name, var] : *it)
+                        {
+                                if(frames.size() > 1 && !seen.emplace(name, true).second)
+                                {
+                                        continue;
+                                }
+
+                                if(var.exported)
+                                {
+                                        visible.emplace_back(name, &var);
+                                }
+                        }
+                }
+
+                /* all the strings go in one block; arrays export their first element */
+                std::size_t block_size = 0;
+                for(const auto& [name, var] : visible)
+                {
+                        block_size += name.size() + exported_value(*var).size() + 2;
+                }
+
+                env_block.clear();
+                env_block.reserve(block_size);
+                std::vector<std::size_t> offsets;
+                offsets.reserve(visible.size());
+
+                for(const auto& [name, var] : visible)
+                {
+                        offsets.push_back(env_block.size());
+                        env_block.append(name);
+                        env_block.push_back('=');
+                        env_block.append(exported_value(*var));
+                        env_block.push_back('\0');
+                }
+
+                env_ptrs.clear();
+                env_ptrs.reserve(offsets.size() + 1);
+                for(const auto offset : offsets)
+                {
+                        env_ptrs.push_back(env_block.data() + offset);
+                }
+                env_ptrs.push_back(nullptr);
+
+                envp_generation = env_generation;
+        }
+
+        static std::string_view exported_value(const Variable& var)
+        {
+                if(var.array == nullptr)
+                {
+                        return var.value;
+                }
+
+                return (var.array->size() > 0) ? (*var.array)[0] : std::string_view();
+        }
+
+        std::vector<frame_t> frames;
+        std::uint64_t generation = 0;
+        std::uint64_t env_generation = 1;
+        std::uint64_t envp_generation = 0;
+        std::string env_block;
+        std::vector<char*> env_ptrs;
+};
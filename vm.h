@@ -0,0 +1,1031 @@
+/* compiled programs
+ *
+ * a syntax tree is compiled into a flat array of instructions whose operands
+ * index a table of strings; simple commands keep their words split, so
+ * running a loop body again only expands and executes them, without going
+ * back to the source text */
+struct Program
+{
+        enum class Op : std::uint8_t
+        {
+                RUN,             /* a: first word, b: number of words */
+                PIPELINE,        /* a: number of stages, b: pipe size or NONE; a STAGE per stage follows */
+                STAGE,           /* a: first instruction of the stage, b: end of the stage */
+                JUMP,            /* a: target */
+                JUMP_IF_FAILURE, /* a: target */
+                JUMP_IF_SUCCESS, /* a: target */
+                NEGATE,
+                SET_STATUS,      /* a: status */
+                FOR_BEGIN,       /* a: first word, b: number of words */
+                FOR_NEXT,        /* a: variable, b: target once the words run out */
+                FOR_END,         /* drops the words of the innermost loop */
+                CASE_BEGIN,      /* a: the word that is matched */
+                CASE_MATCH,      /* a: pattern, b: target if it matches */
+                REDIRECT,        /* a: first word, b: number of words; the status tells if it worked */
+                UNREDIRECT,
+                DEFINE,          /* a: name, b: index in 'functions' */
+                SUBSHELL,        /* a: end of the body that follows, b: IN_PROCESS or FORK */
+                CONDITIONAL      /* a: first word, b: number of words */
+        };
+
+        struct Instr
+        {
+                Op op;
+                std::uint32_t a = 0;
+                std::uint32_t b = 0;
+        };
+
+        static constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+
+        /* how a subshell runs */
+        static constexpr std::uint32_t FORK = 0;
+        static constexpr std::uint32_t IN_PROCESS = 1;
+
+        std::vector<Instr> code;
+        std::vector<std::string> strings;
+
+        /* the compiled bodies of the functions defined by the program */
+        std::vector<std::shared_ptr<const Program>> functions;
+};
+
+class Compiler
+{
+public:
+        /* syntax errors found here (misplaced 'break', bad redirections) are
+         * reported and make the whole program fail */
+        static bool compile(const list_t& list, Program& program)
+        {
+                Compiler compiler(program);
+                return compiler.compile_list(list);
+        }
+
+private:
+        using Op = Program::Op;
+        using Kind = CommandNode::Kind;
+
+        /* the constructs a 'break' or 'continue' may jump out of */
+        struct Construct
+        {
+                enum class Type
+                {
+                        FOR,
+                        WHILE,
+                        REDIRECT
+                };
+
+                Type type;
+                std::size_t continue_target = 0;
+                std::vector<std::size_t> breaks = {}; /* jumps to patch with the exit */
+        };
+
+        explicit Compiler(Program& program)
+            : program(program)
+        {
+        }
+
+        std::size_t here() const
+        {
+                return program.code.size();
+        }
+
+        std::size_t emit(const Op op, const std::size_t a = 0, const std::size_t b = 0)
+        {
+                program.code.push_back({op, static_cast<std::uint32_t>(a), static_cast<std::uint32_t>(b)});
+                return program.code.size() - 1;
+        }
+
+        /* points the jump at 'pos' to the current position */
+        void patch(const std::size_t pos)
+        {
+                program.code[pos].a = static_cast<std::uint32_t>(here());
+        }
+
+        std::size_t add_words(const auto& words)
+        {
+                const std::size_t first = program.strings.size();
+                for(const auto& word : words)
+                {
+                        program.strings.emplace_back(word);
+                }
+
+                return first;
+        }
+
+        bool compile_list(const list_t& list)
+        {
+                for(const auto& and_or : list)
+                {
+                        if(!compile_and_or(and_or))
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        /* a pipeline that fails an '&&' (or succeeds an '||') skips the next
+         * one; the status is left as it is for the operators that follow */
+        bool compile_and_or(const AndOrNode& node)
+        {
+                if(!compile_pipeline(node.pipelines[0]))
+                {
+                        return false;
+                }
+
+                for(std::size_t i = 0; i < node.and_ops.size(); ++i)
+                {
+                        const auto skip = emit(node.and_ops[i] ? Op::JUMP_IF_FAILURE : Op::JUMP_IF_SUCCESS);
+                        if(!compile_pipeline(node.pipelines[i + 1]))
+                        {
+                                return false;
+                        }
+                        patch(skip);
+                }
+
+                return true;
+        }
+
+        bool compile_pipeline(const PipelineNode& node)
+        {
+                const auto& commands = node.commands;
+
+                /* an optional 'pipesize SIZE' prefix sets the pipe capacity */
+                std::vector<std::string_view> first_words(commands[0].words);
+                std::size_t pipe_size = Program::NONE;
+                if(commands[0].kind == Kind::SIMPLE && first_words.size() > 2 &&
+                   first_words[0] == "pipesize")
+                {
+                        if(!parse_size(first_words[1]).has_value())
+                        {
+                                print_err_fmt("shellter: pipesize: invalid pipe size: '{}'\n", first_words[1]);
+                                return false;
+                        }
+
+                        pipe_size = add_words(std::array{first_words[1]});
+                        first_words.erase(first_words.begin(), first_words.begin() + 2);
+                }
+
+                if(commands.size() == 1)
+                {
+                        const bool ok = (pipe_size == Program::NONE) ? compile_command(commands[0])
+                                                                     : compile_simple(first_words);
+                        if(ok && node.negate)
+                        {
+                                emit(Op::NEGATE);
+                        }
+                        return ok;
+                }
+
+                emit(Op::PIPELINE, commands.size(), pipe_size);
+                const std::size_t table = here();
+                for(std::size_t i = 0; i < commands.size(); ++i)
+                {
+                        emit(Op::STAGE);
+                }
+
+                /* stages run in their own processes: nothing in them can jump
+                 * out to an enclosing loop */
+                std::vector<Construct> saved_constructs;
+                std::swap(saved_constructs, constructs);
+
+                bool ok = true;
+                for(std::size_t i = 0; i < commands.size() && ok; ++i)
+                {
+                        program.code[table + i].a = static_cast<std::uint32_t>(here());
+                        ok = (i == 0 && pipe_size != Program::NONE) ? compile_simple(first_words)
+                                                                    : compile_command(commands[i]);
+                        program.code[table + i].b = static_cast<std::uint32_t>(here());
+                }
+
+                std::swap(saved_constructs, constructs);
+
+                if(ok && node.negate)
+                {
+                        emit(Op::NEGATE);
+                }
+
+                return ok;
+        }
+
+        bool compile_command(const CommandNode& node)
+        {
+                std::size_t redirect = Program::NONE;
+                if(!node.redirections.empty())
+                {
+                        if(!check_words(node.redirections))
+                        {
+                                return false;
+                        }
+
+                        emit(Op::REDIRECT, add_words(node.redirections), node.redirections.size());
+                        redirect = emit(Op::JUMP_IF_FAILURE);
+                        constructs.push_back({Construct::Type::REDIRECT});
+                }
+
+                bool ok = true;
+                switch(node.kind)
+                {
+                case Kind::SIMPLE:
+                        ok = compile_simple(node.words);
+                        break;
+                case Kind::IF:
+                        ok = compile_if(node);
+                        break;
+                case Kind::WHILE:
+                case Kind::UNTIL:
+                        ok = compile_while(node);
+                        break;
+                case Kind::FOR:
+                        ok = compile_for(node);
+                        break;
+                case Kind::CASE:
+                        ok = compile_case(node);
+                        break;
+                case Kind::FUNCTION:
+                        ok = compile_function(node);
+                        break;
+                case Kind::GROUP:
+                        ok = compile_list(node.lists[0]);
+                        break;
+                case Kind::SUBSHELL:
+                        ok = compile_subshell(node);
+                        break;
+                case Kind::CONDITIONAL:
+                        emit(Op::CONDITIONAL, add_words(node.words), node.words.size());
+                        break;
+                }
+
+                if(redirect != Program::NONE)
+                {
+                        constructs.pop_back();
+                        patch(redirect);
+                        emit(Op::UNREDIRECT);
+                }
+
+                return ok;
+        }
+
+        bool compile_simple(const std::vector<std::string_view>& words)
+        {
+                if(words.empty())
+                {
+                        emit(Op::SET_STATUS, EXIT_SUCCESS);
+                        return true;
+                }
+
+                if(words[0] == "break" || words[0] == "continue")
+                {
+                        return compile_loop_control(words);
+                }
+
+                if(!check_words(words))
+                {
+                        return false;
+                }
+
+                emit(Op::RUN, add_words(words), words.size());
+                return true;
+        }
+
+        /* checks the redirections in a command for the mistakes the old line
+         * based syntax check caught */
+        static bool check_words(const std::vector<std::string_view>& words)
+        {
+                std::string text;
+                for(const auto word : words)
+                {
+                        text.append(word);
+                        text.push_back(' ');
+                }
+
+                const std::string masked = mask_expansions(text);
+                if(masked.find_first_of("<>") == masked.npos)
+                {
+                        return true;
+                }
+
+                return !check_syntax_errors(masked);
+        }
+
+        /* 'break [N]' and 'continue [N]' are resolved here into jumps */
+        bool compile_loop_control(const std::vector<std::string_view>& words)
+        {
+                const bool is_break = (words[0] == "break");
+
+                std::optional<std::size_t> levels = 1;
+                if(words.size() == 2)
+                {
+                        const bool digits = words[1].find_first_not_of("0123456789") == words[1].npos;
+                        levels = digits ? parse_size(words[1]) : std::nullopt;
+                }
+
+                if(words.size() > 2 || !levels.has_value() || *levels == 0)
+                {
+                        print_err_fmt("shellter: {} usage: {} [N]\n", words[0], words[0]);
+                        return false;
+                }
+
+                const auto loops = std::count_if(constructs.begin(), constructs.end(),
+                                                 [](const Construct& c)
+                                                 {
+                                                         return c.type != Construct::Type::REDIRECT;
+                                                 });
+                if(loops == 0)
+                {
+                        print_err_fmt("shellter: {}: only meaningful in a loop\n", words[0]);
+                        return false;
+                }
+
+                /* more levels than loops means the outermost one */
+                std::size_t remaining = std::min(*levels, static_cast<std::size_t>(loops));
+
+                emit(Op::SET_STATUS, EXIT_SUCCESS);
+                for(auto it = constructs.rbegin(); it != constructs.rend(); ++it)
+                {
+                        if(it->type == Construct::Type::REDIRECT)
+                        {
+                                emit(Op::UNREDIRECT);
+                                continue;
+                        }
+
+                        const bool target = (--remaining == 0);
+                        if(target && !is_break)
+                        {
+                                emit(Op::JUMP, it->continue_target);
+                                return true;
+                        }
+
+                        if(it->type == Construct::Type::FOR)
+                        {
+                                emit(Op::FOR_END);
+                        }
+
+                        if(target)
+                        {
+                                it->breaks.push_back(emit(Op::JUMP));
+                                return true;
+                        }
+                }
+
+                return true;
+        }
+
+        bool compile_if(const CommandNode& node)
+        {
+                std::vector<std::size_t> ends;
+
+                const std::size_t branches = node.lists.size() / 2;
+                for(std::size_t i = 0; i < branches; ++i)
+                {
+                        if(!compile_list(node.lists[2 * i]))
+                        {
+                                return false;
+                        }
+
+                        const auto next = emit(Op::JUMP_IF_FAILURE);
+                        if(!compile_list(node.lists[2 * i + 1]))
+                        {
+                                return false;
+                        }
+
+                        ends.push_back(emit(Op::JUMP));
+                        patch(next);
+                }
+
+                /* without an else branch, a false condition leaves a status of 0 */
+                if(node.lists.size() % 2 == 1)
+                {
+                        if(!compile_list(node.lists.back()))
+                        {
+                                return false;
+                        }
+                }
+                else
+                {
+                        emit(Op::SET_STATUS, EXIT_SUCCESS);
+                }
+
+                for(const auto end : ends)
+                {
+                        patch(end);
+                }
+
+                return true;
+        }
+
+        bool compile_while(const CommandNode& node)
+        {
+                const std::size_t start = here();
+                if(!compile_list(node.lists[0]))
+                {
+                        return false;
+                }
+
+                const auto exit = emit((node.kind == Kind::WHILE) ? Op::JUMP_IF_FAILURE : Op::JUMP_IF_SUCCESS);
+
+                constructs.push_back({Construct::Type::WHILE, start});
+                const bool ok = compile_list(node.lists[1]);
+                emit(Op::JUMP, start);
+
+                patch(exit);
+                finish_loop();
+
+                return ok;
+        }
+
+        bool compile_for(const CommandNode& node)
+        {
+                const std::span words(node.words.begin() + 1, node.words.end());
+                emit(Op::FOR_BEGIN, add_words(words), words.size());
+
+                const std::size_t next = emit(Op::FOR_NEXT, add_words(std::array{node.words[0]}));
+
+                constructs.push_back({Construct::Type::FOR, next});
+                const bool ok = compile_list(node.lists[0]);
+                emit(Op::JUMP, next);
+
+                program.code[next].b = static_cast<std::uint32_t>(here());
+                finish_loop();
+
+                return ok;
+        }
+
+        /* the loop status is 0 once it's done, whether it ran or not */
+        void finish_loop()
+        {
+                for(const auto pos : constructs.back().breaks)
+                {
+                        patch(pos);
+                }
+                constructs.pop_back();
+
+                emit(Op::SET_STATUS, EXIT_SUCCESS);
+        }
+
+        bool compile_case(const CommandNode& node)
+        {
+                emit(Op::CASE_BEGIN, add_words(std::array{node.words[0]}));
+
+                std::vector<std::vector<std::size_t>> matches(node.items.size());
+                for(std::size_t i = 0; i < node.items.size(); ++i)
+                {
+                        for(const auto pattern : node.items[i].patterns)
+                        {
+                                matches[i].push_back(emit(Op::CASE_MATCH, add_words(std::array{pattern})));
+                        }
+                }
+
+                emit(Op::SET_STATUS, EXIT_SUCCESS);
+                std::vector<std::size_t> ends = {emit(Op::JUMP)};
+
+                for(std::size_t i = 0; i < node.items.size(); ++i)
+                {
+                        for(const auto pos : matches[i])
+                        {
+                                program.code[pos].b = static_cast<std::uint32_t>(here());
+                        }
+
+                        emit(Op::SET_STATUS, EXIT_SUCCESS);
+                        if(!compile_list(node.items[i].body))
+                        {
+                                return false;
+                        }
+                        ends.push_back(emit(Op::JUMP));
+                }
+
+                for(const auto end : ends)
+                {
+                        patch(end);
+                }
+
+                return true;
+        }
+
+        bool compile_subshell(const CommandNode& node)
+        {
+                const auto subshell = emit(Op::SUBSHELL);
+
+                /* like pipeline stages, a subshell can't jump out to an enclosing loop */
+                std::vector<Construct> saved_constructs;
+                std::swap(saved_constructs, constructs);
+                const bool ok = compile_list(node.lists[0]);
+                std::swap(saved_constructs, constructs);
+
+                program.code[subshell].a = static_cast<std::uint32_t>(here());
+                program.code[subshell].b = can_run_in_process(subshell + 1, here()) ? Program::IN_PROCESS
+                                                                                     : Program::FORK;
+
+                return ok;
+        }
+
+        /* true if the instructions in [begin, end) only change what a subshell
+         * can save and restore: variables, the directory and the shell options.
+         * That rules out external commands, pipelines, function definitions and
+         * the builtins that end the shell or change other state */
+        bool can_run_in_process(const std::size_t begin, const std::size_t end) const
+        {
+                for(std::size_t pc = begin; pc < end; ++pc)
+                {
+                        const Program::Instr& instr = program.code[pc];
+                        if(instr.op == Op::PIPELINE || instr.op == Op::DEFINE)
+                        {
+                                return false;
+                        }
+
+                        if(instr.op != Op::RUN)
+                        {
+                                continue;
+                        }
+
+                        /* the command name must be known now: no expansions, no quotes */
+                        const std::string_view name = program.strings[instr.a];
+                        if(name.find_first_of("$`'\"\\") != name.npos || !builtin_funcs.contains(name) ||
+                           name == "exit" || name == "quit" || name == "alias" || name == "unalias" ||
+                           name == "umask" || name == "source" || name == "." || name == "enable")
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        /* the body is compiled once, into a program of its own, when the
+         * definition is compiled; running the definition only binds the name */
+        bool compile_function(const CommandNode& node)
+        {
+                auto body = std::make_shared<Program>();
+                if(!compile(node.lists[0], *body))
+                {
+                        return false;
+                }
+
+                emit(Op::DEFINE, add_words(std::array{node.words[0]}), program.functions.size());
+                program.functions.push_back(std::move(body));
+
+                return true;
+        }
+
+        Program& program;
+        std::vector<Construct> constructs;
+};
+
+/* functions defined with 'NAME() { ... }'; they run in the shell process, with a
+ * scope of their own for 'local' variables and their arguments as $1, $2, ... */
+class ShellFunctions
+{
+public:
+        using function_t = std::shared_ptr<const Program>;
+
+        static void define(const std::string_view name, function_t body)
+        {
+                functions.insert_or_assign(std::string(name), std::move(body));
+        }
+
+        static bool empty()
+        {
+                return functions.empty();
+        }
+
+        /* returns null if there's no function called 'name' */
+        static function_t find(const std::string_view name)
+        {
+                const auto it = functions.find(name);
+                return (it != functions.end()) ? it->second : nullptr;
+        }
+
+        static int call(const function_t& body, const std::span<const std::string> args);
+
+        /* exchanges all the definitions, for the shells of the library */
+        using table_t = string_map_t<function_t>;
+        static void swap(table_t& other)
+        {
+                functions.swap(other);
+        }
+
+private:
+        static constexpr std::size_t MAX_DEPTH = 1000;
+
+        static string_map_t<function_t> functions;
+};
+
+string_map_t<ShellFunctions::function_t> ShellFunctions::functions;
+
+class Interpreter
+{
+public:
+        /* runs the instructions in [begin, end) and returns the last status */
+        static int run(const Program& program, const std::size_t begin, const std::size_t end)
+        {
+                Interpreter interp(program);
+                interp.execute(begin, end);
+
+                return last_status;
+        }
+
+        static int run(const Program& program)
+        {
+                return run(program, 0, program.code.size());
+        }
+
+        /* runs a whole script or '-c' string: an external command after which
+         * the script has nothing left to do is exec'd without forking, so the
+         * shell doesn't stay around just to wait for it */
+        static int run_script(const Program& program)
+        {
+                Interpreter interp(program);
+                interp.tail_exec = true;
+                interp.execute(0, program.code.size());
+
+                return last_status;
+        }
+
+private:
+        using Op = Program::Op;
+
+        struct Loop
+        {
+                std::vector<std::string> words;
+                std::size_t next = 0;
+        };
+
+        explicit Interpreter(const Program& program)
+            : program(program)
+        {
+        }
+
+        /* a 'return' may leave redirections behind; the innermost goes first */
+        ~Interpreter()
+        {
+                while(!redirections.empty())
+                {
+                        redirections.pop_back();
+                }
+        }
+
+        /* whether the program ends at 'pc', maybe through forward jumps */
+        bool finishes(std::size_t pc, const std::size_t end) const
+        {
+                while(pc < end && program.code[pc].op == Op::JUMP && program.code[pc].a > pc)
+                {
+                        pc = program.code[pc].a;
+                }
+
+                return pc >= end && loops.empty() && redirections.empty();
+        }
+
+        std::span<const std::string> words(const Program::Instr& instr) const
+        {
+                return std::span(program.strings).subspan(instr.a, instr.b);
+        }
+
+        /* expands the words of an instruction; false if one of them is bad */
+        bool expand(const Program::Instr& instr, std::vector<std::string>& out) const
+        {
+                for(const auto& word : words(instr))
+                {
+                        if(!WordExpander::expand(word, out))
+                        {
+                                return false;
+                        }
+                }
+
+                return true;
+        }
+
+        void execute(const std::size_t begin, const std::size_t end)
+        {
+                const auto& code = program.code;
+
+                std::size_t pc = begin;
+                while(pc < end && running && !function_returning)
+                {
+                        const Program::Instr& instr = code[pc++];
+                        switch(instr.op)
+                        {
+                        case Op::RUN:
+                                last_status = BasicCommand::process(words(instr), nullptr,
+                                                                    tail_exec && finishes(pc, end));
+                                break;
+                        case Op::PIPELINE:
+                                last_status = run_pipeline(pc - 1);
+                                pc = code[pc + instr.a - 1].b;
+                                break;
+                        case Op::STAGE:
+                                break;
+                        case Op::JUMP:
+                                pc = instr.a;
+                                break;
+                        case Op::JUMP_IF_FAILURE:
+                                pc = (last_status != EXIT_SUCCESS) ? instr.a : pc;
+                                break;
+                        case Op::JUMP_IF_SUCCESS:
+                                pc = (last_status == EXIT_SUCCESS) ? instr.a : pc;
+                                break;
+                        case Op::NEGATE:
+                                last_status = (last_status == EXIT_SUCCESS) ? EXIT_FAILURE : EXIT_SUCCESS;
+                                break;
+                        case Op::SET_STATUS:
+                                last_status = static_cast<int>(instr.a);
+                                break;
+                        case Op::FOR_BEGIN:
+                        {
+                                Loop& loop = loops.emplace_back();
+                                for(const auto& word : words(instr))
+                                {
+                                        if(!WordExpander::expand_words(word, loop.words))
+                                        {
+                                                loop.words.clear();
+                                                break;
+                                        }
+                                }
+                                break;
+                        }
+                        case Op::FOR_NEXT:
+                        {
+                                /* the stacks can only run empty in a corrupt cached script */
+                                if(loops.empty())
+                                {
+                                        pc = instr.b;
+                                        break;
+                                }
+
+                                Loop& loop = loops.back();
+                                if(loop.next == loop.words.size())
+                                {
+                                        loops.pop_back();
+                                        pc = instr.b;
+                                        break;
+                                }
+
+                                shell_vars.set(program.strings[instr.a], std::move(loop.words[loop.next++]));
+                                break;
+                        }
+                        case Op::FOR_END:
+                                if(!loops.empty())
+                                {
+                                        loops.pop_back();
+                                }
+                                break;
+                        case Op::CASE_BEGIN:
+                                case_word.clear();
+                                WordExpander::expand_joined(program.strings[instr.a], case_word);
+                                break;
+                        case Op::CASE_MATCH:
+                        {
+                                std::string pattern;
+                                if(WordExpander::expand_pattern(program.strings[instr.a], pattern) &&
+                                   GlobPattern(pattern).match(case_word))
+                                {
+                                        pc = instr.b;
+                                }
+                                break;
+                        }
+                        case Op::REDIRECT:
+                                last_status = redirect(instr) ? EXIT_SUCCESS : EXIT_FAILURE;
+                                break;
+                        case Op::UNREDIRECT:
+                                if(!redirections.empty())
+                                {
+                                        redirections.pop_back();
+                                }
+                                break;
+                        case Op::DEFINE:
+                                ShellFunctions::define(program.strings[instr.a], program.functions[instr.b]);
+                                last_status = EXIT_SUCCESS;
+                                break;
+                        case Op::SUBSHELL:
+                                last_status = run_subshell(pc, instr);
+                                pc = instr.a;
+                                break;
+                        case Op::CONDITIONAL:
+                                last_status = run_conditional(instr);
+                                break;
+                        }
+                }
+        }
+
+        int run_pipeline(const std::size_t pos)
+        {
+                const auto& code = program.code;
+                const Program::Instr& instr = code[pos];
+
+                std::size_t pipe_size = shell_options.pipe_size;
+                if(instr.b != Program::NONE)
+                {
+                        pipe_size = parse_size(program.strings[instr.b]).value_or(pipe_size);
+                }
+
+                return PipeSequence::process(instr.a, pipe_size,
+                                             [&](const std::size_t i, std::vector<pid_t>* const pids)
+                                             {
+                                                     const Program::Instr& stage = code[pos + 1 + i];
+
+                                                     /* simple commands fork only when they must */
+                                                     if(stage.b - stage.a == 1 && code[stage.a].op == Op::RUN)
+                                                     {
+                                                             return BasicCommand::process(words(code[stage.a]), pids);
+                                                     }
+
+                                                     return run_compound_stage(stage, pids);
+                                             });
+        }
+
+        /* compound commands in a pipeline run in a child of their own */
+        int run_compound_stage(const Program::Instr& stage, std::vector<pid_t>* const pids)
+        {
+                const pid_t child_pid = fork();
+                if(child_pid == 0)
+                {
+                        PipeSequence::close_next_input();
+
+                        Interpreter child(program);
+                        child.execute(stage.a, stage.b);
+                        exit_child(last_status);
+                }
+
+                if(child_pid < 0)
+                {
+                        print_err_fmt("shellter: fork: {}\n", strerror(errno));
+                        return EXIT_FAILURE;
+                }
+
+                if(pids != nullptr)
+                {
+                        pids->push_back(child_pid);
+                        return EXIT_SUCCESS;
+                }
+
+                return wait_child(child_pid);
+        }
+
+        /* the words of '[[ ... ]]' aren't split; the ones right of '==' and '!='
+         * are patterns and the ones right of '=~' regular expressions, where
+         * quoting makes characters match themselves */
+        int run_conditional(const Program::Instr& instr)
+        {
+                const auto raw = words(instr);
+
+                std::vector<std::string> args(raw.size());
+                for(std::size_t i = 0; i < raw.size(); ++i)
+                {
+                        const std::string_view op = (i > 0) ? std::string_view(raw[i - 1]) : std::string_view();
+
+                        bool ok = true;
+                        if(op == "=~")
+                        {
+                                ok = WordExpander::expand_regex(raw[i], args[i]);
+                        }
+                        else if(op == "==" || op == "=" || op == "!=")
+                        {
+                                ok = WordExpander::expand_pattern(raw[i], args[i]);
+                        }
+                        else
+                        {
+                                ok = WordExpander::expand_joined(raw[i], args[i]);
+                        }
+
+                        if(!ok)
+                        {
+                                return Condition::ERROR;
+                        }
+                }
+
+                StatCache::invalidate();
+
+                const std::vector<std::string_view> operands(args.begin(), args.end());
+                return Condition::evaluate(operands, "[[", true);
+        }
+
+        /* what a subshell running in the shell process may change */
+        struct SavedState
+        {
+                VariableStore vars = shell_vars.snapshot();
+                std::vector<std::string> params = positional_params;
+                ShellOptions options = shell_options;
+                fs::path cwd = current_dir();
+                fs::path oldpwd = old_path;
+                bool oldpwd_set = old_path_set;
+                bool returning = function_returning;
+        };
+
+        static fs::path current_dir()
+        {
+                std::error_code ec;
+                return fs::current_path(ec);
+        }
+
+        int run_subshell(const std::size_t begin, const Program::Instr& instr)
+        {
+                if(instr.b == Program::IN_PROCESS && !calls_function(begin, instr.a))
+                {
+                        SavedState saved{};
+                        {
+                                Interpreter sub(program);
+                                sub.execute(begin, instr.a);
+                        }
+
+                        shell_vars.restore(std::move(saved.vars));
+                        positional_params = std::move(saved.params);
+                        shell_options = saved.options;
+                        function_returning = saved.returning;
+                        old_path = std::move(saved.oldpwd);
+                        old_path_set = saved.oldpwd_set;
+
+                        if(!saved.cwd.empty() && current_dir() != saved.cwd)
+                        {
+                                std::error_code ec;
+                                fs::current_path(saved.cwd, ec);
+                        }
+
+                        return last_status;
+                }
+
+                const pid_t child_pid = fork();
+                if(child_pid == 0)
+                {
+                        Interpreter child(program);
+                        child.execute(begin, instr.a);
+                        exit_child(last_status);
+                }
+
+                if(child_pid < 0)
+                {
+                        print_err_fmt("shellter: fork: {}\n", strerror(errno));
+                        return EXIT_FAILURE;
+                }
+
+                return wait_child(child_pid);
+        }
+
+        /* a function may shadow one of the builtins the compiler counted on */
+        bool calls_function(const std::size_t begin, const std::size_t end) const
+        {
+                if(ShellFunctions::empty())
+                {
+                        return false;
+                }
+
+                for(std::size_t pc = begin; pc < end; ++pc)
+                {
+                        const Program::Instr& instr = program.code[pc];
+                        if(instr.op == Op::RUN && ShellFunctions::find(program.strings[instr.a]) != nullptr)
+                        {
+                                return true;
+                        }
+                }
+
+                return false;
+        }
+
+        bool redirect(const Program::Instr& instr)
+        {
+                auto& saved = redirections.emplace_back(std::make_unique<SavedFds>());
+
+                std::vector<std::string> args;
+                if(!expand(instr, args))
+                {
+                        return false;
+                }
+
+                const auto rest = BasicCommand::handle_redirections(args, *saved);
+                return rest.has_value() && rest->empty();
+        }
+
+        const Program& program;
+        std::vector<Loop> loops;
+        std::string case_word;
+        std::vector<std::unique_ptr<SavedFds>> redirections;
+        bool tail_exec = false;
+};
+
+/* 'body' is held by the caller, so redefining the function while it runs is safe */
+int ShellFunctions::call(const function_t& body, const std::span<const std::string> args)
+{
+        if(function_depth == MAX_DEPTH)
+        {
+                print_err_fmt("shellter: {}: maximum function nesting level exceeded ({})\n", args[0],
+                              MAX_DEPTH);
+                return EXIT_FAILURE;
+        }
+
+        /* $0 stays the name of the shell or script */
+        std::vector<std::string> params;
+        params.reserve(args.size());
+        params.push_back(positional_params[0]);
+        params.insert(params.end(), args.begin() + 1, args.end());
+        std::swap(params, positional_params);
+
+        shell_vars.push_scope();
+        ++function_depth;
+
+        const int status = Interpreter::run(*body);
+
+        --function_depth;
+        function_returning = false;
+        shell_vars.pop_scope();
+        std::swap(params, positional_params);
+
+        return status;
+}